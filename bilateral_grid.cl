@@ -0,0 +1,99 @@
+// File: bilateral_grid.cl
+// Bilateral grid engine. Shares genFloating, genGray and genOutput with
+// local_laplacian.cl, only the tone mapping of the gray image differs.
+
+#define gridS 16
+#define gridZ 16
+#define detail 2.0f
+
+// Convention:
+// grid layout - (z * gh + gy) * gw + gx, each cell holds (sum, weight)
+// gw, gh - grid size, gridZ range bins over [0, 1]
+
+// One work-item per grid column, so the splat needs no atomics.
+__kernel
+void gridConstruct(__global float2 *grid, __global float *gray,
+	int width, int height)
+{
+	int gx = get_global_id(0);
+	int gy = get_global_id(1);
+	int gw = get_global_size(0);
+	int gh = get_global_size(1);
+	float2 acc[gridZ];
+
+	for (int z = 0; z < gridZ; z++)
+		acc[z] = (float2)(0.0f, 0.0f);
+
+	int x0 = max(gx * gridS - gridS / 2, 0);
+	int x1 = min(gx * gridS + gridS / 2, width);
+	int y0 = max(gy * gridS - gridS / 2, 0);
+	int y1 = min(gy * gridS + gridS / 2, height);
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			float g = gray[y * width + x];
+			int z = clamp((int)(g * (gridZ - 1) + 0.5f), 0, gridZ - 1);
+			acc[z] += (float2)(g, 1.0f);
+		}
+	}
+
+	for (int z = 0; z < gridZ; z++)
+		grid[(z * gh + gy) * gw + gx] = acc[z];
+}
+
+// [1 4 6 4 1] / 16 along one axis (0 - x, 1 - y, 2 - z), zero outside.
+// This function needs to be called 3 times, once per axis.
+__kernel
+void gridBlur(__global float2 *dest, __global float2 *src, int axis)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int z = get_global_id(2);
+	int gw = get_global_size(0);
+	int gh = get_global_size(1);
+	int i = (z * gh + y) * gw + x;
+	int pos = axis == 0 ? x : (axis == 1 ? y : z);
+	int size = get_global_size(axis);
+	int stride = axis == 0 ? 1 : (axis == 1 ? gw : gw * gh);
+	const float weights[5] = { 1.0f, 4.0f, 6.0f, 4.0f, 1.0f };
+	float2 sum = (float2)(0.0f, 0.0f);
+
+	for (int d = -2; d <= 2; d++) {
+		if (pos + d >= 0 && pos + d < size)
+			sum += weights[d + 2] * src[i + d * stride];
+	}
+	dest[i] = sum / 16.0f;
+}
+
+// Trilinear lookup of the blurred grid gives the base layer, the detail
+// layer (gray - base) is scaled by detail.
+__kernel
+void gridSlice(__global float *dest, __global float2 *grid,
+	__global float *gray, int gw, int gh)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int width = get_global_size(0);
+
+	float g = gray[y * width + x];
+	float fx = (float)x / gridS;
+	float fy = (float)y / gridS;
+	float fz = clamp(g, 0.0f, 1.0f) * (gridZ - 1);
+	int x0 = min((int)fx, gw - 1);
+	int y0 = min((int)fy, gh - 1);
+	int z0 = min((int)fz, gridZ - 1);
+	int x1 = min(x0 + 1, gw - 1);
+	int y1 = min(y0 + 1, gh - 1);
+	int z1 = min(z0 + 1, gridZ - 1);
+	float wx = clamp(fx - x0, 0.0f, 1.0f);
+	float wy = clamp(fy - y0, 0.0f, 1.0f);
+	float wz = clamp(fz - z0, 0.0f, 1.0f);
+
+	float2 c00 = mix(grid[(z0 * gh + y0) * gw + x0], grid[(z0 * gh + y0) * gw + x1], wx);
+	float2 c01 = mix(grid[(z0 * gh + y1) * gw + x0], grid[(z0 * gh + y1) * gw + x1], wx);
+	float2 c10 = mix(grid[(z1 * gh + y0) * gw + x0], grid[(z1 * gh + y0) * gw + x1], wx);
+	float2 c11 = mix(grid[(z1 * gh + y1) * gw + x0], grid[(z1 * gh + y1) * gw + x1], wx);
+	float2 v = mix(mix(c00, c01, wy), mix(c10, c11, wy), wz);
+
+	float base = v.y > 0.0f ? v.x / v.y : g;
+	dest[y * width + x] = base + detail * (g - base);
+}
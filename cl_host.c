@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cl_host.h"
+
+static cl_program load_program(cl_context context, cl_device_id device,
+	const char **filenames, cl_uint num_files, cl_int *err_ptr);
+static cl_int create_kernels(cl_program program, cl_kernel *kernels);
+
+cl_int ctx_create(struct host_ctx *ctx, const char **filenames, cl_uint num_files)
+{
+	cl_platform_id *platforms = NULL;
+	cl_device_id *devices = NULL;
+	cl_uint num_devices;
+	char *devName;
+	char *devVer;
+	size_t cb;
+	cl_int err;
+	cl_uint num;
+
+	memset(ctx, 0, sizeof(*ctx));
+
+	// get the id of supporting OpenCL platforms
+	CL_CHECK(clGetPlatformIDs(0, 0, &num));
+	if (num == 0) {
+		fprintf(stderr, "Unable to get platforms\n");
+		err = CL_DEVICE_NOT_FOUND;
+		goto cleanup;
+	}
+	platforms = (cl_platform_id*)malloc(num * sizeof(cl_platform_id));
+	if (platforms == NULL) {
+		err = CL_OUT_OF_HOST_MEMORY;
+		goto cleanup;
+	}
+	CL_CHECK(clGetPlatformIDs(num, &platforms[0], NULL));
+	printf("There are %d platform(s) on this device\n", num);
+	ctx->platform = platforms[0];
+
+	// create a OpenCL context
+	cl_context_properties prop[] = { CL_CONTEXT_PLATFORM, (cl_context_properties) ctx->platform, 0 };
+	ctx->context = clCreateContextFromType(prop, CL_DEVICE_TYPE_GPU, NULL, NULL, &err);
+	if (ctx->context == 0)
+	{
+		fprintf(stderr, "Can't create OpenCL context: %d\n", err);
+		goto cleanup;
+	}
+
+	// get a list of devices
+	CL_CHECK(clGetContextInfo(ctx->context, CL_CONTEXT_DEVICES, 0, NULL, &cb));
+	devices = (cl_device_id*) malloc(cb);
+	if (devices == NULL) {
+		err = CL_OUT_OF_HOST_MEMORY;
+		goto cleanup;
+	}
+	CL_CHECK(clGetContextInfo(ctx->context, CL_CONTEXT_DEVICES, cb, &devices[0], 0));
+	num_devices = (cl_uint)(cb / sizeof(cl_device_id));
+	printf("There are %d device(s) in the context\n", num_devices);
+	ctx->device = devices[0];
+
+	// show devices info, the sizes returned include the terminating null
+	for(cl_uint i = 0; i < num_devices; i++)
+	{
+		// get device name
+		CL_CHECK(clGetDeviceInfo(devices[i], CL_DEVICE_NAME, 0, NULL, &cb));
+		devName = (char*) calloc(cb + 1, sizeof(char));
+		if (devName) {
+			if (clGetDeviceInfo(devices[i], CL_DEVICE_NAME, cb, &devName[0], NULL) == CL_SUCCESS)
+				printf("Device: %s", devName);
+			free(devName);
+		}
+
+		// get device supports version
+		CL_CHECK(clGetDeviceInfo(devices[i], CL_DEVICE_VERSION, 0, NULL, &cb));
+		devVer = (char*) calloc(cb + 1, sizeof(char));
+		if (devVer) {
+			if (clGetDeviceInfo(devices[i], CL_DEVICE_VERSION, cb, &devVer[0], NULL) == CL_SUCCESS)
+				printf(" ( supports %s)\n", devVer);
+			free(devVer);
+		}
+	}
+
+	// construct command queue
+	ctx->queue = clCreateCommandQueue(ctx->context, ctx->device, 0, &err);
+	if (ctx->queue == 0)
+	{
+		fprintf(stderr, "Can't create command queue: %d\n", err);
+		goto cleanup;
+	}
+
+	// create and compile the program object
+	ctx->program = load_program(ctx->context, ctx->device, filenames, num_files, &err);
+	if (ctx->program == 0)
+	{
+		fprintf(stderr, "Error, can't load or build program\n");
+		goto cleanup;
+	}
+
+	// create kernel objects from program
+	CL_CHECK(create_kernels(ctx->program, ctx->kernels));
+
+cleanup:
+	free(devices);
+	free(platforms);
+	if (err != CL_SUCCESS)
+		ctx_release(ctx);
+	return err;
+}
+
+void ctx_release(struct host_ctx *ctx)
+{
+	ctx_release_buffers(ctx, 0);
+	for (int i = 0; i < NUM_KERNELS; i++) {
+		if (ctx->kernels[i])
+			clReleaseKernel(ctx->kernels[i]);
+		ctx->kernels[i] = 0;
+	}
+	if (ctx->program)
+		clReleaseProgram(ctx->program);
+	if (ctx->queue)
+		clReleaseCommandQueue(ctx->queue);
+	if (ctx->context)
+		clReleaseContext(ctx->context);
+	ctx->program = 0;
+	ctx->queue = 0;
+	ctx->context = 0;
+}
+
+cl_int ctx_create_buffer(struct host_ctx *ctx, size_t size, cl_mem *mem)
+{
+	cl_int err;
+
+	*mem = 0;
+	if (ctx->num_mems == MAX_MEM_OBJECTS)
+		return CL_OUT_OF_HOST_MEMORY;
+
+	*mem = clCreateBuffer(ctx->context, 0, size, NULL, &err);
+	if (err != CL_SUCCESS) {
+		*mem = 0;
+		return err;
+	}
+	ctx->mems[ctx->num_mems++] = *mem;
+
+	return CL_SUCCESS;
+}
+
+void ctx_release_buffers(struct host_ctx *ctx, int mark)
+{
+	while (ctx->num_mems > mark)
+		clReleaseMemObject(ctx->mems[--ctx->num_mems]);
+}
+
+// All files are built into a single program, in the given order.
+static cl_program load_program(cl_context context, cl_device_id device,
+	const char **filenames, cl_uint num_files, cl_int *err_ptr)
+{
+	FILE *fp;
+	long length;
+	char **data;
+	cl_program program = 0;
+	cl_int err = CL_INVALID_VALUE;
+	cl_uint loaded = 0;
+
+	data = (char**)calloc(num_files, sizeof(char*));
+	if (data == NULL) {
+		*err_ptr = CL_OUT_OF_HOST_MEMORY;
+		return 0;
+	}
+
+	for (; loaded < num_files; loaded++)
+	{
+		// open file
+		fp = fopen(filenames[loaded], "rb");
+		if (fp == NULL) {
+			perror(filenames[loaded]);
+			goto cleanup;
+		}
+
+		// get file length
+		fseek (fp, 0, SEEK_END);
+		length = ftell (fp);
+		fseek (fp, 0, SEEK_SET);    // rewind(fp);
+
+		// read program source
+		data[loaded] = length < 0 ? NULL : (char*)malloc((length+1) * sizeof(char));
+		if (data[loaded] == NULL ||
+			fread(data[loaded], sizeof(char), length, fp) != (size_t)length) {
+			fprintf(stderr, "Error reading %s\n", filenames[loaded]);
+			fclose(fp);
+			goto cleanup;
+		}
+		data[loaded][length] = 0;
+		fclose(fp);
+	}
+
+	// create and build program object
+	program = clCreateProgramWithSource(context, num_files, (const char **)data, NULL, &err);
+	if(program == 0) {
+		fprintf(stderr, "Error creating program: %d\n", err);
+		goto cleanup;
+	}
+
+	// compile program
+	err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+	if(err != CL_SUCCESS)
+	{
+		size_t len = 0;
+		char *buffer;
+
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
+		buffer = calloc(sizeof(char), len + 1);
+		if (buffer)
+			clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, len, buffer, NULL);
+		fprintf(stderr, "Error building program %d: %s\n", err, buffer ? buffer : "");
+		free(buffer);
+		clReleaseProgram(program);
+		program = 0;
+	}
+
+cleanup:
+	for (cl_uint i = 0; i < num_files; i++)
+		free(data[i]);
+	free(data);
+
+	*err_ptr = err;
+	return program;
+}
+
+static cl_int create_kernels(cl_program program, cl_kernel *kernels)
+{
+	cl_int err = CL_SUCCESS;
+	const char *kernels_name[NUM_KERNELS] = {
+		"genFloating",
+		"genGray",
+		"genGPyramid0",
+		"downSampleKernel",
+		"genOutLPyramidLowest",
+		"genOutLPyramid",
+		"genOutGPyramid",
+		"genOutput",
+		"gridConstruct",
+		"gridBlur",
+		"gridSlice",
+		"accumOutLPyramid",
+	};
+	for (int i = 0; i < NUM_KERNELS; i++)
+	{
+		kernels[i] = clCreateKernel(program, kernels_name[i], &err);
+		if (err != CL_SUCCESS)
+		{
+			fprintf(stderr, "Create kernel %s error %d\n", kernels_name[i], err);
+			kernels[i] = 0;
+			return err;
+		}
+	}
+
+	return CL_SUCCESS;
+}
@@ -0,0 +1,66 @@
+#ifndef CL_HOST_H
+#define CL_HOST_H
+
+#include <stdio.h>
+#if defined(__APPLE__)
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#define NUM_KERNELS 12
+#define GEN_FLOATING 0
+#define GEN_GRAY 1
+#define GEN_GPYRAMID0 2
+#define DOWNSAMPLE_KERNEL 3
+//#define GEN_LPYRAMID 4
+#define GEN_OUTLPYRAMIDLOWEST 4
+#define GEN_OUTLPYRAMID 5
+#define GEN_OUTGPYRAMID 6
+#define GEN_OUTPUT 7
+#define GRID_CONSTRUCT 8
+#define GRID_BLUR 9
+#define GRID_SLICE 10
+#define ACCUM_OUTLPYRAMID 11
+
+#define MAX_MEM_OBJECTS 256
+
+// Owns every OpenCL object of the host pipeline. Buffers made with
+// ctx_create_buffer are released by ctx_release_buffers or ctx_release,
+// so error paths only have to jump to their cleanup label.
+struct host_ctx {
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue queue;
+	cl_program program;
+	cl_kernel kernels[NUM_KERNELS];
+	cl_mem mems[MAX_MEM_OBJECTS];
+	int num_mems;
+	int low_memory;     // use the low-memory local Laplacian path
+};
+
+// Reports a failed call and jumps to the enclosing cleanup label,
+// expects a cl_int err in scope.
+#define CL_CHECK(call) \
+	do { \
+		err = (call); \
+		if (err != CL_SUCCESS) { \
+			fprintf(stderr, "%s:%d: %s failed: %d\n", __FILE__, __LINE__, #call, err); \
+			goto cleanup; \
+		} \
+	} while (0)
+
+// Failures worth retrying with less device memory.
+#define IS_ALLOC_FAILURE(err) \
+	((err) == CL_MEM_OBJECT_ALLOCATION_FAILURE || (err) == CL_OUT_OF_RESOURCES)
+
+cl_int ctx_create(struct host_ctx *ctx, const char **filenames, cl_uint num_files);
+void ctx_release(struct host_ctx *ctx);
+
+cl_int ctx_create_buffer(struct host_ctx *ctx, size_t size, cl_mem *mem);
+// Buffers are released LIFO: ctx_release_buffers(ctx, mark) drops every
+// buffer created after mark = ctx->num_mems was taken.
+void ctx_release_buffers(struct host_ctx *ctx, int mark);
+
+#endif
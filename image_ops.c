@@ -0,0 +1,423 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+#include "image_ops.h"
+
+#define MAX_THREADS 64
+#define MIN_PIXELS_PER_THREAD (128 * 1024)
+
+// Row-parallel driver
+
+typedef void (*row_fn)(void *arg, int chunk, int y0, int y1);
+
+struct row_job {
+	row_fn fn;
+	void *arg;
+	int chunk;
+	int y0, y1;
+};
+
+static void *row_worker(void *p)
+{
+	struct row_job *job = (struct row_job *)p;
+	job->fn(job->arg, job->chunk, job->y0, job->y1);
+	return NULL;
+}
+
+static int num_chunks(int width, int height)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	long by_size = (long)width * height / MIN_PIXELS_PER_THREAD;
+
+	if (n > by_size)
+		n = by_size;
+	if (n > height)
+		n = height;
+	if (n > MAX_THREADS)
+		n = MAX_THREADS;
+	return n < 1 ? 1 : (int)n;
+}
+
+// Splits [0, height) into contiguous chunks, chunk 0 runs on the caller.
+// A chunk whose thread can't be started also runs on the caller.
+static void parallel_rows(int width, int height, row_fn fn, void *arg)
+{
+	pthread_t threads[MAX_THREADS];
+	int started[MAX_THREADS];
+	struct row_job jobs[MAX_THREADS];
+	int chunks = num_chunks(width, height);
+
+	for (int i = 0; i < chunks; i++) {
+		jobs[i].fn = fn;
+		jobs[i].arg = arg;
+		jobs[i].chunk = i;
+		jobs[i].y0 = (int)((long)height * i / chunks);
+		jobs[i].y1 = (int)((long)height * (i + 1) / chunks);
+	}
+	for (int i = 1; i < chunks; i++)
+		started[i] = pthread_create(&threads[i], NULL, row_worker, &jobs[i]) == 0;
+
+	row_worker(&jobs[0]);
+	for (int i = 1; i < chunks; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			row_worker(&jobs[i]);
+	}
+}
+
+// Deinterleave / interleave
+
+struct rgba_args {
+	uint8_t **rows;
+	int width;
+	uint8_t *r, *g, *b;
+};
+
+static void deinterleave_rows(void *p, int chunk, int y0, int y1)
+{
+	(void)chunk;
+	struct rgba_args *a = (struct rgba_args *)p;
+	int width = a->width;
+
+	for (int y = y0; y < y1; y++) {
+		const uint8_t *src = a->rows[y];
+		uint8_t *r = a->r + (size_t)width * y;
+		uint8_t *g = a->g + (size_t)width * y;
+		uint8_t *b = a->b + (size_t)width * y;
+		int x = 0;
+#if defined(__SSE2__)
+		const __m128i mask = _mm_set1_epi32(0xff);
+		for (; x + 16 <= width; x += 16) {
+			__m128i p0 = _mm_loadu_si128((const __m128i *)(src + 4 * x));
+			__m128i p1 = _mm_loadu_si128((const __m128i *)(src + 4 * x + 16));
+			__m128i p2 = _mm_loadu_si128((const __m128i *)(src + 4 * x + 32));
+			__m128i p3 = _mm_loadu_si128((const __m128i *)(src + 4 * x + 48));
+			__m128i vr = _mm_packus_epi16(
+				_mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask)),
+				_mm_packs_epi32(_mm_and_si128(p2, mask), _mm_and_si128(p3, mask)));
+			__m128i vg = _mm_packus_epi16(
+				_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+					_mm_and_si128(_mm_srli_epi32(p1, 8), mask)),
+				_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 8), mask),
+					_mm_and_si128(_mm_srli_epi32(p3, 8), mask)));
+			__m128i vb = _mm_packus_epi16(
+				_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+					_mm_and_si128(_mm_srli_epi32(p1, 16), mask)),
+				_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 16), mask),
+					_mm_and_si128(_mm_srli_epi32(p3, 16), mask)));
+			_mm_storeu_si128((__m128i *)(r + x), vr);
+			_mm_storeu_si128((__m128i *)(g + x), vg);
+			_mm_storeu_si128((__m128i *)(b + x), vb);
+		}
+#elif defined(USE_NEON)
+		for (; x + 16 <= width; x += 16) {
+			uint8x16x4_t px = vld4q_u8(src + 4 * x);
+			vst1q_u8(r + x, px.val[0]);
+			vst1q_u8(g + x, px.val[1]);
+			vst1q_u8(b + x, px.val[2]);
+		}
+#endif
+		for (; x < width; x++) {
+			r[x] = src[4 * x];
+			g[x] = src[4 * x + 1];
+			b[x] = src[4 * x + 2];
+		}
+	}
+}
+
+static void interleave_rows(void *p, int chunk, int y0, int y1)
+{
+	(void)chunk;
+	struct rgba_args *a = (struct rgba_args *)p;
+	int width = a->width;
+
+	for (int y = y0; y < y1; y++) {
+		uint8_t *dest = a->rows[y];
+		const uint8_t *r = a->r + (size_t)width * y;
+		const uint8_t *g = a->g + (size_t)width * y;
+		const uint8_t *b = a->b + (size_t)width * y;
+		int x = 0;
+#if defined(__SSE2__)
+		for (; x + 16 <= width; x += 16) {
+			__m128i p0 = _mm_loadu_si128((const __m128i *)(dest + 4 * x));
+			__m128i p1 = _mm_loadu_si128((const __m128i *)(dest + 4 * x + 16));
+			__m128i p2 = _mm_loadu_si128((const __m128i *)(dest + 4 * x + 32));
+			__m128i p3 = _mm_loadu_si128((const __m128i *)(dest + 4 * x + 48));
+			__m128i va = _mm_packus_epi16(
+				_mm_packs_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24)),
+				_mm_packs_epi32(_mm_srli_epi32(p2, 24), _mm_srli_epi32(p3, 24)));
+			__m128i vr = _mm_loadu_si128((const __m128i *)(r + x));
+			__m128i vg = _mm_loadu_si128((const __m128i *)(g + x));
+			__m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+			__m128i rg_lo = _mm_unpacklo_epi8(vr, vg);
+			__m128i rg_hi = _mm_unpackhi_epi8(vr, vg);
+			__m128i ba_lo = _mm_unpacklo_epi8(vb, va);
+			__m128i ba_hi = _mm_unpackhi_epi8(vb, va);
+			_mm_storeu_si128((__m128i *)(dest + 4 * x), _mm_unpacklo_epi16(rg_lo, ba_lo));
+			_mm_storeu_si128((__m128i *)(dest + 4 * x + 16), _mm_unpackhi_epi16(rg_lo, ba_lo));
+			_mm_storeu_si128((__m128i *)(dest + 4 * x + 32), _mm_unpacklo_epi16(rg_hi, ba_hi));
+			_mm_storeu_si128((__m128i *)(dest + 4 * x + 48), _mm_unpackhi_epi16(rg_hi, ba_hi));
+		}
+#elif defined(USE_NEON)
+		for (; x + 16 <= width; x += 16) {
+			uint8x16x4_t px = vld4q_u8(dest + 4 * x);
+			px.val[0] = vld1q_u8(r + x);
+			px.val[1] = vld1q_u8(g + x);
+			px.val[2] = vld1q_u8(b + x);
+			vst4q_u8(dest + 4 * x, px);
+		}
+#endif
+		for (; x < width; x++) {
+			dest[4 * x] = r[x];
+			dest[4 * x + 1] = g[x];
+			dest[4 * x + 2] = b[x];
+		}
+	}
+}
+
+void deinterleave_rgba(uint8_t **rows, int width, int height,
+	uint8_t *r, uint8_t *g, uint8_t *b)
+{
+	struct rgba_args args = { rows, width, r, g, b };
+	parallel_rows(width, height, deinterleave_rows, &args);
+}
+
+void interleave_rgba(uint8_t **rows, int width, int height,
+	const uint8_t *r, const uint8_t *g, const uint8_t *b)
+{
+	struct rgba_args args = { rows, width, (uint8_t *)r, (uint8_t *)g, (uint8_t *)b };
+	parallel_rows(width, height, interleave_rows, &args);
+}
+
+// uchar <-> float
+
+struct convert_args {
+	float *f;
+	uint8_t *u;
+	int width;
+};
+
+static void uchar_to_float_rows(void *p, int chunk, int y0, int y1)
+{
+	(void)chunk;
+	struct convert_args *a = (struct convert_args *)p;
+	const uint8_t *src = a->u + (size_t)a->width * y0;
+	float *dest = a->f + (size_t)a->width * y0;
+	size_t n = (size_t)a->width * (y1 - y0);
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(255.0f);
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_ps(dest + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dest + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dest + i + 8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+		_mm_storeu_ps(dest + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+	}
+#elif defined(USE_NEON)
+	const float32x4_t scale = vdupq_n_f32(255.0f);
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8(src + i);
+		uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+		uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+		vst1q_f32(dest + i, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), scale));
+		vst1q_f32(dest + i + 4, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), scale));
+		vst1q_f32(dest + i + 8, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), scale));
+		vst1q_f32(dest + i + 12, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), scale));
+	}
+#endif
+	for (; i < n; i++)
+		dest[i] = (float)src[i] / 255.0f;
+}
+
+// NaN maps to 0 on every path, as in the SSE max/min ordering.
+static void float_to_uchar_rows(void *p, int chunk, int y0, int y1)
+{
+	(void)chunk;
+	struct convert_args *a = (struct convert_args *)p;
+	const float *src = a->f + (size_t)a->width * y0;
+	uint8_t *dest = a->u + (size_t)a->width * y0;
+	size_t n = (size_t)a->width * (y1 - y0);
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	__m128i q[4];
+	for (; i + 16 <= n; i += 16) {
+		for (int k = 0; k < 4; k++) {
+			__m128 v = _mm_max_ps(_mm_loadu_ps(src + i + 4 * k), zero);
+			v = _mm_min_ps(v, one);
+			q[k] = _mm_cvttps_epi32(_mm_mul_ps(v, scale));
+		}
+		_mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(
+			_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+	}
+#elif defined(USE_NEON)
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	const float32x4_t one = vdupq_n_f32(1.0f);
+	const float32x4_t scale = vdupq_n_f32(255.0f);
+	uint16x4_t q[4];
+	for (; i + 16 <= n; i += 16) {
+		for (int k = 0; k < 4; k++) {
+			float32x4_t v = vmaxnmq_f32(vld1q_f32(src + i + 4 * k), zero);
+			v = vminq_f32(v, one);
+			q[k] = vmovn_u32(vcvtq_u32_f32(vmulq_f32(v, scale)));
+		}
+		vst1q_u8(dest + i, vcombine_u8(
+			vmovn_u16(vcombine_u16(q[0], q[1])),
+			vmovn_u16(vcombine_u16(q[2], q[3]))));
+	}
+#endif
+	for (; i < n; i++) {
+		float c = src[i] > 0.0f ? src[i] : 0.0f;
+		c = c < 1.0f ? c : 1.0f;
+		dest[i] = (uint8_t)(c * 255.0f);
+	}
+}
+
+void uchar_to_float(float *dest, const uint8_t *src, int width, int height)
+{
+	struct convert_args args = { dest, (uint8_t *)src, width };
+	parallel_rows(width, height, uchar_to_float_rows, &args);
+}
+
+void float_to_uchar(uint8_t *dest, const float *src, int width, int height)
+{
+	struct convert_args args = { (float *)src, dest, width };
+	parallel_rows(width, height, float_to_uchar_rows, &args);
+}
+
+// Diff
+
+// Flush the 32-bit squared error lanes before they can overflow.
+#define SSE_FLUSH_INTERVAL 4096
+
+struct diff_partial {
+	uint64_t sse;
+	long mismatches;
+	int max_error;
+};
+
+struct diff_args {
+	const uint8_t *a, *b;
+	int width;
+	int tolerance;
+	struct diff_partial partial[MAX_THREADS];
+};
+
+static void diff_rows(void *p, int chunk, int y0, int y1)
+{
+	struct diff_args *args = (struct diff_args *)p;
+	const uint8_t *a = args->a + (size_t)args->width * y0;
+	const uint8_t *b = args->b + (size_t)args->width * y0;
+	size_t n = (size_t)args->width * (y1 - y0);
+	int tolerance = args->tolerance;
+	uint64_t sse = 0;
+	long mismatches = 0;
+	int max_error = 0;
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i tol = _mm_set1_epi8((char)tolerance);
+	__m128i vmax = zero;
+	while (i + 16 <= n) {
+		__m128i acc = zero;
+		uint32_t lanes[4];
+		for (int it = 0; it < SSE_FLUSH_INTERVAL && i + 16 <= n; it++, i += 16) {
+			__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+			__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+			__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+			__m128i within = _mm_cmpeq_epi8(_mm_subs_epu8(d, tol), zero);
+			__m128i lo = _mm_unpacklo_epi8(d, zero);
+			__m128i hi = _mm_unpackhi_epi8(d, zero);
+			vmax = _mm_max_epu8(vmax, d);
+			mismatches += 16 - __builtin_popcount(_mm_movemask_epi8(within));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+		}
+		_mm_storeu_si128((__m128i *)lanes, acc);
+		sse += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	uint8_t maxes[16];
+	_mm_storeu_si128((__m128i *)maxes, vmax);
+	for (int k = 0; k < 16; k++)
+		max_error = maxes[k] > max_error ? maxes[k] : max_error;
+#elif defined(USE_NEON)
+	const uint8x16_t tol = vdupq_n_u8((uint8_t)tolerance);
+	uint8x16_t vmax = vdupq_n_u8(0);
+	while (i + 16 <= n) {
+		uint32x4_t acc = vdupq_n_u32(0);
+		for (int it = 0; it < SSE_FLUSH_INTERVAL && i + 16 <= n; it++, i += 16) {
+			uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+			uint8x16_t over = vcgtq_u8(d, tol);
+			vmax = vmaxq_u8(vmax, d);
+			mismatches += vaddvq_u8(vshrq_n_u8(over, 7));
+			acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+			acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+		}
+		sse += vaddlvq_u32(acc);
+	}
+	max_error = vmaxvq_u8(vmax);
+#endif
+	for (; i < n; i++) {
+		int d = abs((int)a[i] - (int)b[i]);
+		sse += (uint64_t)(d * d);
+		mismatches += d > tolerance;
+		max_error = d > max_error ? d : max_error;
+	}
+
+	args->partial[chunk].sse = sse;
+	args->partial[chunk].mismatches = mismatches;
+	args->partial[chunk].max_error = max_error;
+}
+
+void diff_images(struct image_diff *result, const uint8_t *a, const uint8_t *b,
+	int width, int height, int tolerance)
+{
+	// unused chunks stay zeroed
+	struct diff_args args = { 0 };
+	uint64_t sse = 0;
+
+	if (tolerance < 0)
+		tolerance = 0;
+	if (tolerance > 255)
+		tolerance = 255;
+
+	args.a = a;
+	args.b = b;
+	args.width = width;
+	args.tolerance = tolerance;
+	parallel_rows(width, height, diff_rows, &args);
+
+	result->max_error = 0;
+	result->mismatches = 0;
+	result->samples = (long)width * height;
+	for (int i = 0; i < MAX_THREADS; i++) {
+		sse += args.partial[i].sse;
+		result->mismatches += args.partial[i].mismatches;
+		if (args.partial[i].max_error > result->max_error)
+			result->max_error = args.partial[i].max_error;
+	}
+
+	result->mse = result->samples ? (double)sse / result->samples : 0.0;
+	result->psnr = result->mse > 0.0 ?
+		10.0 * log10(255.0 * 255.0 / result->mse) : INFINITY;
+}
@@ -0,0 +1,32 @@
+#ifndef IMAGE_OPS_H
+#define IMAGE_OPS_H
+
+#include <stdint.h>
+
+// Host-side per-pixel routines. All of them are vectorised (SSE2 / NEON,
+// scalar fallback) and split the rows across threads for large images.
+// Planes are tightly packed, width * height elements each.
+
+// RGBA rows -> planar r, g, b. Alpha is dropped.
+void deinterleave_rgba(uint8_t **rows, int width, int height,
+	uint8_t *r, uint8_t *g, uint8_t *b);
+// Planar r, g, b -> RGBA rows. Alpha already in the rows is kept.
+void interleave_rgba(uint8_t **rows, int width, int height,
+	const uint8_t *r, const uint8_t *g, const uint8_t *b);
+
+// Same conversions as genFloating / genOutput in local_laplacian.cl.
+void uchar_to_float(float *dest, const uint8_t *src, int width, int height);
+void float_to_uchar(uint8_t *dest, const float *src, int width, int height);
+
+struct image_diff {
+	int max_error;      // largest absolute difference
+	long mismatches;    // samples differing by more than the tolerance
+	long samples;
+	double mse;
+	double psnr;        // dB, INFINITY for identical images
+};
+
+void diff_images(struct image_diff *result, const uint8_t *a, const uint8_t *b,
+	int width, int height, int tolerance);
+
+#endif
@@ -0,0 +1,84 @@
+// Compares the RGB channels of two PNGs and reports max abs error, PSNR and
+// the number of samples off by more than the tolerance. Exits non-zero when
+// the images differ in size or the optional thresholds are not met.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "png_io.h"
+#include "image_ops.h"
+
+static uint8_t *load_planes(char *file_name, int *w, int *h)
+{
+	if (read_png_file(file_name) != 0)
+		return NULL;
+
+	size_t n = (size_t)width * height;
+	uint8_t *planes = (uint8_t *)malloc(3 * n);
+	if (!planes)
+		abort_("[imgdiff] out of memory");
+	deinterleave_rgba(row_pointers, width, height, planes, planes + n, planes + 2 * n);
+	free_png_rows(row_pointers, height);
+	row_pointers = NULL;
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+	*w = width;
+	*h = height;
+	return planes;
+}
+
+int main(int argc, char **argv)
+{
+	int tolerance = 0;
+	double min_psnr = 0.0;
+	double max_mismatch = 100.0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:p:m:")) != -1) {
+		switch (opt) {
+		case 't': tolerance = atoi(optarg); break;
+		case 'p': min_psnr = atof(optarg); break;
+		case 'm': max_mismatch = atof(optarg); break;
+		default:
+			abort_("Usage: imgdiff [-t tolerance] [-p min_psnr] "
+				"[-m max_mismatch_percent] <file_a> <file_b>");
+		}
+	}
+	if (argc - optind != 2)
+		abort_("Usage: imgdiff [-t tolerance] [-p min_psnr] "
+			"[-m max_mismatch_percent] <file_a> <file_b>");
+
+	int wa, ha, wb, hb;
+	uint8_t *a = load_planes(argv[optind], &wa, &ha);
+	uint8_t *b = load_planes(argv[optind + 1], &wb, &hb);
+	if (!a || !b || wa != wb || ha != hb) {
+		if (a && b)
+			printf("Size mismatch: %dx%d vs %dx%d\n", wa, ha, wb, hb);
+		printf("FAIL\n");
+		free(b);
+		free(a);
+		return 1;
+	}
+
+	// the three planes are contiguous, diff them as one 3*height image
+	struct image_diff diff;
+	diff_images(&diff, a, b, wa, 3 * ha, tolerance);
+	double mismatch = diff.samples ? 100.0 * diff.mismatches / diff.samples : 0.0;
+
+	printf("Max abs error: %d\n", diff.max_error);
+	printf("PSNR: %.2lf dB\n", diff.psnr);
+	printf("Mismatches (> %d): %ld / %ld (%.4lf%%)\n",
+		tolerance, diff.mismatches, diff.samples, mismatch);
+
+	free(b);
+	free(a);
+
+	if (diff.psnr < min_psnr || mismatch > max_mismatch) {
+		printf("FAIL\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
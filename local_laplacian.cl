@@ -247,6 +247,35 @@ void genOutLPyramidLowest(__global float *dest,
 	dest[y * width + x] = 
 		(1.0f - lf) * lPyramid1 + lf * lPyramid2;
 }
+
+// Low-memory variant of genOutLPyramid / genOutLPyramidLowest that only
+// needs the pyramid of level k. Call it for k = 0 .. levels - 1 in order,
+// k = 0 initializes dest. gPyramidLow is ignored when lowest is set.
+__kernel
+void accumOutLPyramid(__global float *dest,
+	__global float *gPyramid,
+	__global float *gPyramidLow,
+	__global float *inGPyramid,
+	int k, int lowest)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int width = get_global_size(0);
+	int height = get_global_size(1);
+	
+	float level = inGPyramid[y * width + x] * (levels - 1);
+	int li = clamp((int)level, 0, levels - 2);
+	float lf = level - (float)li;
+	float sum = k == 0 ? 0.0f : dest[y * width + x];
+	if (k == li || k == li + 1) {
+		float lPyramid = gPyramid[y * width + x];
+		if (!lowest)
+			lPyramid -= upSample(x, y, width / 2, height / 2, gPyramidLow);
+		sum += (k == li ? 1.0f - lf : lf) * lPyramid;
+	}
+	dest[y * width + x] = sum;
+}
+
 __kernel
 void genOutGPyramid(__global float *dest, 
 	__global float *outGPyramidLow, 
@@ -2,611 +2,531 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <stdarg.h>
-#include <assert.h>
 #include <sys/time.h>
-#if defined(__APPLE__)
-#include <OpenCL/opencl.h>
-#else
-#include <CL/cl.h>
-#endif
-
-#define PNG_DEBUG 3
-#include <png.h>
-
-#define NUM_KERNELS 8
-#define GEN_FLOATING 0
-#define GEN_GRAY 1
-#define GEN_GPYRAMID0 2
-#define DOWNSAMPLE_KERNEL 3
-//#define GEN_LPYRAMID 4
-#define GEN_OUTLPYRAMIDLOWEST 4
-#define GEN_OUTLPYRAMID 5
-#define GEN_OUTGPYRAMID 6
-#define GEN_OUTPUT 7
+
+#include "cl_host.h"
+#include "png_io.h"
+#include "image_ops.h"
 
 #define maxJ 8
 #define levels 8
 
-void abort_(const char * s, ...)
-{
-	va_list args;
-	va_start(args, s);
-	vfprintf(stderr, s, args);
-	fprintf(stderr, "\n");
-	va_end(args);
-	abort();
-}
+#define gridS 16
+#define gridZ 16
+
+#define ENGINE_LAPLACIAN 0
+#define ENGINE_GRID 1
+#define NUM_ENGINES 2
+
+// Sets argument index of kernel to value, expects ctx and err in scope.
+#define SET_ARG(kernel, index, value) \
+	CL_CHECK(clSetKernelArg(ctx->kernels[kernel], index, sizeof(value), &(value)))
+
+#define USAGE "Usage: program_name [-e laplacian|grid] [-b] [-l] " \
+	"<file_in> <file_out> [<file_in> <file_out> ...]"
 
-int x, y;
+typedef cl_int (*engine_fn)(struct host_ctx *ctx, cl_mem gray,
+	cl_mem *floating, cl_mem *dst);
 
-int width, height;
-png_byte color_type;
-png_byte bit_depth;
+cl_int laplacian_engine(struct host_ctx *ctx, cl_mem gray, cl_mem *floating, cl_mem *dst);
+cl_int grid_engine(struct host_ctx *ctx, cl_mem gray, cl_mem *floating, cl_mem *dst);
 
-png_structp png_ptr;
-png_infop info_ptr;
-int number_of_passes;
-png_bytep * row_pointers;
+const char *engine_names[NUM_ENGINES] = { "laplacian", "grid" };
+engine_fn engines[NUM_ENGINES] = { laplacian_engine, grid_engine };
 
-void read_png_file(char* file_name);
-void write_png_file(char* file_name);
 void process_file(void);
 
 void getRGB(uint8_t *r, uint8_t *g, uint8_t *b)
 {
-	for (y = 0; y < height; y++) {
-		png_byte* row = row_pointers[y];
-		for (x = 0; x < width; x++) {
-			png_byte* ptr = &(row[x*4]);
-			r[width*y + x] = ptr[0];
-			g[width*y + x] = ptr[1];
-			b[width*y + x] = ptr[2];
-		}
-	}
+	deinterleave_rgba(row_pointers, width, height, r, g, b);
 }
 
 void returnRGB(uint8_t *r, uint8_t *g, uint8_t *b)
 {
-	for (y = 0; y < height; y++) {
-		png_byte* row = row_pointers[y];
-		for (x = 0; x < width; x++) {
-			png_byte* ptr = &(row[x*4]);
-			ptr[0] = r[width*y + x];
-			ptr[1] = g[width*y + x];
-			ptr[2] = b[width*y + x];
-		}
-	}
+	interleave_rgba(row_pointers, width, height, r, g, b);
 }
 
-cl_program load_program(cl_context context, cl_device_id device, const char* filename);
-
-int clCreateKernels(cl_program program, cl_kernel **kernels_ptr);
-int clReleaseKernels(cl_kernel *kernels);
+cl_int process_png(struct host_ctx *ctx, char *file_in, char *file_out,
+	int engine, int compare);
+cl_int process(struct host_ctx *ctx, int engine, uint8_t **src, uint8_t **dst);
+cl_int gen_output(struct host_ctx *ctx, cl_mem *dst, cl_mem tone,
+	cl_mem *floating, cl_mem gray);
 
 int main(int argc, char **argv)
 {
-	uint8_t *src_r;
-	uint8_t *src_g;
-	uint8_t *src_b;
-
-	uint8_t *dst_r;
-	uint8_t *dst_g;
-	uint8_t *dst_b;
-
-	// OpenCL
-	cl_platform_id *platforms;
-	cl_context context;
-	cl_uint num_devices;
-	cl_device_id *devices;
-	cl_command_queue queue;
-	cl_program program;
-	cl_kernel *kernels;
-	char *devName;
-	char *devVer;
-	size_t cb;
-	cl_int err;
-	cl_uint num;
-	size_t global_work_size[2];
-	size_t local_work_size[2] = {16, 16};
-	struct timeval tim;   
-	
-	// get the id of supporting OpenCL platforms
-	err = clGetPlatformIDs(0, 0, &num);
-	if (err != CL_SUCCESS)
-	{
-		perror("Unable to get platforms");
-		return 0;
+	struct host_ctx ctx;
+	const char *sources[] = { "local_laplacian.cl", "bilateral_grid.cl" };
+	int engine = ENGINE_LAPLACIAN;
+	int compare = 0;
+	int low_memory = 0;
+	int failed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:bl")) != -1) {
+		switch (opt) {
+		case 'e':
+			if (strcmp(optarg, engine_names[ENGINE_GRID]) == 0)
+				engine = ENGINE_GRID;
+			else if (strcmp(optarg, engine_names[ENGINE_LAPLACIAN]) == 0)
+				engine = ENGINE_LAPLACIAN;
+			else
+				abort_("Unknown engine %s (laplacian or grid)", optarg);
+			break;
+		case 'b':
+			compare = 1;
+			break;
+		case 'l':
+			low_memory = 1;
+			break;
+		default:
+			abort_(USAGE);
+		}
 	}
-	platforms = (cl_platform_id*)malloc(num * sizeof(cl_platform_id));
-	clGetPlatformIDs(num, &platforms[0], NULL);
-	printf("There are %d platform(s) on this device\n", num);
-	
-	// create a OpenCL context
-	cl_context_properties prop[] = { CL_CONTEXT_PLATFORM, (cl_context_properties) platforms[0], 0 };
-	context = clCreateContextFromType(prop, CL_DEVICE_TYPE_GPU, NULL, NULL, NULL);
-	if (context == 0)
-	{
-		perror("Can't create OpenCL context");
-		return 0;
+	if (argc - optind < 2 || (argc - optind) % 2)
+		abort_(USAGE);
+
+	if (ctx_create(&ctx, sources, 2) != CL_SUCCESS)
+		return 1;
+	ctx.low_memory = low_memory;
+
+	// a failed pair is reported and skipped, the batch goes on
+	for (int i = optind; i < argc; i += 2) {
+		if (process_png(&ctx, argv[i], argv[i + 1], engine, compare) != CL_SUCCESS) {
+			fprintf(stderr, "Failed to process %s\n", argv[i]);
+			failed++;
+		}
 	}
 
-	// get a list of devices
-	clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &cb);
-	devices = (cl_device_id*) malloc(cb / sizeof(cl_device_id)); 
-	clGetContextInfo(context, CL_CONTEXT_DEVICES, cb, &devices[0], 0);
-
-	// get the number of devices
-	clGetContextInfo(context, CL_CONTEXT_NUM_DEVICES, 0, NULL, &cb);
-	clGetContextInfo(context, CL_CONTEXT_NUM_DEVICES, cb, &num_devices, 0);
-	printf("There are %d device(s) in the context\n", num_devices);
-
-	// show devices info
-	for(int i = 0; i < num_devices; i++)
-	{
-		// get device name
-		clGetDeviceInfo(devices[i], CL_DEVICE_NAME, 0, NULL, &cb);
-		devName = (char*) malloc(sizeof(char) * cb);
-		clGetDeviceInfo(devices[i], CL_DEVICE_NAME, cb, &devName[0], NULL);
-		devName[cb] = 0;
-		printf("Device: %s", devName);
-		free(devName);
-		
-		// get device supports version
-		clGetDeviceInfo(devices[i], CL_DEVICE_VERSION, 0, NULL, &cb);
-		devVer = (char*) malloc(sizeof(char) * cb);
-		clGetDeviceInfo(devices[i], CL_DEVICE_VERSION, cb, &devVer[0], NULL);
-		devVer[cb] = 0;
-		printf(" ( supports %s)\n", devVer);
-		free(devVer);
-	}
+	ctx_release(&ctx);
 
-	// construct command queue
-	queue = clCreateCommandQueue(context, devices[0], 0, NULL);
-	if (queue == 0)
-	{
-		perror("Can't create command queue\n");
-		clReleaseContext(context);
-		return 0;
-	}
+	return failed ? 1 : 0;
+}
 
-	// create and compile the program object
-	program = load_program(context, devices[0], "local_laplacian.cl");
-	if (program == 0)
-	{
-		perror("Error, can't load or build program\n");
-		clReleaseCommandQueue(queue);
-		clReleaseContext(context);
+// Runs the selected engine, or all of them with compare, on one file.
+cl_int process_png(struct host_ctx *ctx, char *file_in, char *file_out,
+	int engine, int compare)
+{
+	uint8_t *src[3] = { NULL, NULL, NULL };
+	uint8_t *dst[NUM_ENGINES][3];
+	cl_int err = CL_SUCCESS;
+	struct timeval tim;
+
+	memset(dst, 0, sizeof(dst));
+
+	// file errors are reported like the unreadable kernel sources in load_program
+	if (read_png_file(file_in) != 0)
+		return CL_INVALID_VALUE;
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+	for (int c = 0; c < 3; c++) {
+		src[c] = (uint8_t *)malloc(sizeof(uint8_t) * width * height);
+		if (src[c] == NULL)
+			err = CL_OUT_OF_HOST_MEMORY;
+	}
+	// planes of one engine are contiguous so they can be diffed at once
+	for (int e = 0; e < NUM_ENGINES; e++) {
+		dst[e][0] = (uint8_t *)malloc(sizeof(uint8_t) * width * height * 3);
+		if (dst[e][0] == NULL) {
+			err = CL_OUT_OF_HOST_MEMORY;
+			continue;
+		}
+		dst[e][1] = dst[e][0] + width * height;
+		dst[e][2] = dst[e][1] + width * height;
+	}
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "Out of host memory\n");
+		goto cleanup;
 	}
 
-	// create kernel objects from program
-	err = clCreateKernels(program, &kernels);
-	assert(err == CL_SUCCESS);
-
-	if (argc != 3)
-		abort_("Usage: program_name <file_in> <file_out>");
-
-	read_png_file(argv[1]);
+	// -b runs every engine, after a warm-up pass, and compares them
+	for (int e = 0; e < NUM_ENGINES; e++) {
+		if (!compare && e != engine)
+			continue;
+		if (compare) {
+			getRGB(src[0], src[1], src[2]);
+			CL_CHECK(process(ctx, e, src, dst[e]));
+		}
 
-	gettimeofday(&tim, NULL);  
-    double dTime1 = tim.tv_sec+(tim.tv_usec/1000000.0); 
+		gettimeofday(&tim, NULL);  
+		double dTime1 = tim.tv_sec+(tim.tv_usec/1000000.0); 
 
-	src_r = (uint8_t *)malloc(sizeof(uint8_t) * width * height);
-	src_g = (uint8_t *)malloc(sizeof(uint8_t) * width * height);
-	src_b = (uint8_t *)malloc(sizeof(uint8_t) * width * height);
+		getRGB(src[0], src[1], src[2]);
+		CL_CHECK(process(ctx, e, src, dst[e]));
 
-	dst_r = (uint8_t *)malloc(sizeof(uint8_t) * width * height);
-	dst_g = (uint8_t *)malloc(sizeof(uint8_t) * width * height);
-	dst_b = (uint8_t *)malloc(sizeof(uint8_t) * width * height);
+		gettimeofday(&tim, NULL);  
+		double dTime2 = tim.tv_sec+(tim.tv_usec/1000000.0); 
 
-	// create cl buffers
-	cl_mem src_r_d = clCreateBuffer(context, 0, sizeof(uint8_t) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-	cl_mem src_g_d = clCreateBuffer(context, 0, sizeof(uint8_t) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-	cl_mem src_b_d = clCreateBuffer(context, 0, sizeof(uint8_t) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-
-	cl_mem floating_r = clCreateBuffer(context, 0, sizeof(float) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-	cl_mem floating_g = clCreateBuffer(context, 0, sizeof(float) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-	cl_mem floating_b = clCreateBuffer(context, 0, sizeof(float) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-
-	cl_mem gray = clCreateBuffer(context, 0, sizeof(float) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-
-	cl_mem gPyramid[maxJ][levels];
-	for (int j = 0; j < maxJ; j++) {
-		for (int k = 0; k < levels; k++) {
-			gPyramid[j][k] = 
-				clCreateBuffer(context, 0, 
-					sizeof(float) * (width >> j) * (height >> j),
-					NULL, &err);
-			assert(err == CL_SUCCESS);
-		}
-	}
-	cl_mem inGPyramid[maxJ];
-	for (int j = 0; j < maxJ; j++) {
-		inGPyramid[j] = 
-			clCreateBuffer(context, 0, 
-				sizeof(float) * (width >> j) * (height >> j),
-				NULL, &err);
-		assert(err == CL_SUCCESS);
-	}
-	cl_mem outLPyramid[maxJ];
-	for (int j = 0; j < maxJ; j++) {
-		outLPyramid[j] = 
-			clCreateBuffer(context, 0, 
-				sizeof(float) * (width >> j) * (height >> j),
-				NULL, &err);
-		assert(err == CL_SUCCESS);
+		printf("Engine: %s%s\n", engine_names[e],
+			e == ENGINE_LAPLACIAN && ctx->low_memory ? " (low memory)" : "");
+		printf("Elapsed Time: %lf sec (%.2lf MP/s)\n", dTime2 - dTime1,
+			width * height / 1e6 / (dTime2 - dTime1));
 	}
-	cl_mem outGPyramid[maxJ];
-	for (int j = 0; j < maxJ; j++) {
-		outGPyramid[j] = 
-			clCreateBuffer(context, 0, 
-				sizeof(float) * (width >> j) * (height >> j),
-				NULL, &err);
-		assert(err == CL_SUCCESS);
+
+	if (compare) {
+		struct image_diff diff;
+		diff_images(&diff, dst[ENGINE_GRID][0], dst[ENGINE_LAPLACIAN][0],
+			width, 3 * height, 0);
+		printf("Grid vs laplacian: max abs error %d, PSNR %.2lf dB\n",
+			diff.max_error, diff.psnr);
 	}
-	cl_mem dst_r_d = clCreateBuffer(context, 0, sizeof(uint8_t) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-	cl_mem dst_g_d = clCreateBuffer(context, 0, sizeof(uint8_t) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-	cl_mem dst_b_d = clCreateBuffer(context, 0, sizeof(uint8_t) * width * height, NULL, &err);
-	assert(err == CL_SUCCESS);
-
-
-	getRGB(src_r, src_g, src_b);
-
-	err = clEnqueueWriteBuffer(queue, src_r_d, CL_TRUE, 0, sizeof(uint8_t) * width * height, src_r, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
-	err = clEnqueueWriteBuffer(queue, src_g_d, CL_TRUE, 0, sizeof(uint8_t) * width * height, src_g, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
-	err = clEnqueueWriteBuffer(queue, src_b_d, CL_TRUE, 0, sizeof(uint8_t) * width * height, src_b, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
-	
-	global_work_size[0] = width;
-	global_work_size[1] = height;
 
-	// Floating
-	clSetKernelArg(kernels[GEN_FLOATING], 0, sizeof(floating_r), &floating_r);
-	clSetKernelArg(kernels[GEN_FLOATING], 1, sizeof(src_r_d), &src_r_d);
-	err = clEnqueueNDRangeKernel(queue, kernels[GEN_FLOATING], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
+	returnRGB(dst[engine][0], dst[engine][1], dst[engine][2]);
 
-	clSetKernelArg(kernels[GEN_FLOATING], 0, sizeof(floating_g), &floating_g);
-	clSetKernelArg(kernels[GEN_FLOATING], 1, sizeof(src_g_d), &src_g_d);
-	err = clEnqueueNDRangeKernel(queue, kernels[GEN_FLOATING], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
+	if (write_png_file(file_out) != 0)
+		err = CL_INVALID_VALUE;
 
-	clSetKernelArg(kernels[GEN_FLOATING], 0, sizeof(floating_b), &floating_b);
-	clSetKernelArg(kernels[GEN_FLOATING], 1, sizeof(src_b_d), &src_b_d);
-	err = clEnqueueNDRangeKernel(queue, kernels[GEN_FLOATING], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
+cleanup:
+	if (row_pointers) {
+		free_png_rows(row_pointers, height);
+		row_pointers = NULL;
+	}
+	for (int e = 0; e < NUM_ENGINES; e++)
+		free(dst[e][0]);
+	for (int c = 0; c < 3; c++)
+		free(src[c]);
 
-	// Gray
-	clSetKernelArg(kernels[GEN_GRAY], 0, sizeof(gray), &gray);
-	clSetKernelArg(kernels[GEN_GRAY], 1, sizeof(floating_r), &floating_r);
-	clSetKernelArg(kernels[GEN_GRAY], 2, sizeof(floating_g), &floating_g);
-	clSetKernelArg(kernels[GEN_GRAY], 3, sizeof(floating_b), &floating_b);
-	err = clEnqueueNDRangeKernel(queue, kernels[GEN_GRAY], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
+	return err;
+}
 
-	// gPyramid
-	for (int k = 0; k < levels; k++) {
-		// gPyramid[0]
-		global_work_size[0] = width;
-		global_work_size[1] = height;
-		local_work_size[0] = 16;
-		local_work_size[1] = 16;
-
-		clSetKernelArg(kernels[GEN_GPYRAMID0], 0, sizeof(cl_mem), &gPyramid[0][k]);
-		clSetKernelArg(kernels[GEN_GPYRAMID0], 1, sizeof(int), &k);
-		clSetKernelArg(kernels[GEN_GPYRAMID0], 2, sizeof(cl_mem), &gray);
-		err = clEnqueueNDRangeKernel(queue, kernels[GEN_GPYRAMID0], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-		assert(err == CL_SUCCESS);
-
-		for (int j = 1; j < maxJ; j++) {
-			global_work_size[0] = (width >> j);
-			global_work_size[1] = (height >> j);
-			local_work_size[0] = (width >> j) > 16 ? 16 : (width >> j);
-			local_work_size[1] = (height >> j) > 16 ? 16 : (height >> j);
-
-			clSetKernelArg(kernels[DOWNSAMPLE_KERNEL], 0, sizeof(cl_mem), &gPyramid[j][k]);
-			clSetKernelArg(kernels[DOWNSAMPLE_KERNEL], 1, sizeof(cl_mem), &gPyramid[j-1][k]);
-			err = clEnqueueNDRangeKernel(queue, kernels[DOWNSAMPLE_KERNEL], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-			if (err != CL_SUCCESS) {
-				printf("Error: %d\n", err);
-				return -1;
-			}
-		}
-	}
+static size_t level_size(int j)
+{
+	return sizeof(float) * (width >> j) * (height >> j);
+}
 
+// Enqueues kernel over the (width >> j) x (height >> j) pyramid level.
+static cl_int enqueue_level(struct host_ctx *ctx, int kernel, int j)
+{
+	size_t global_work_size[2];
+	size_t local_work_size[2];
 
-	// inGPyramid[0]
-	clReleaseMemObject(inGPyramid[0]);
-	inGPyramid[0] = gray;
-	clRetainMemObject(inGPyramid[0]);
-	// inGPyramid
-	for (int j = 1; j < maxJ; j++) {
-		global_work_size[0] = (width >> j);
-		global_work_size[1] = (height >> j);
-		local_work_size[0] = (width >> j) > 16 ? 16 : (width >> j);
-		local_work_size[1] = (height >> j) > 16 ? 16 : (height >> j);
-
-		clSetKernelArg(kernels[DOWNSAMPLE_KERNEL], 0, sizeof(cl_mem), &inGPyramid[j]);
-		clSetKernelArg(kernels[DOWNSAMPLE_KERNEL], 1, sizeof(cl_mem), &inGPyramid[j-1]);
-		err = clEnqueueNDRangeKernel(queue, kernels[DOWNSAMPLE_KERNEL], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-		if (err != CL_SUCCESS) {
-			printf("Error: %d\n", err);
-			return -1;
-		}
-	}
+	global_work_size[0] = (width >> j);
+	global_work_size[1] = (height >> j);
+	local_work_size[0] = (width >> j) > 16 ? 16 : (width >> j);
+	local_work_size[1] = (height >> j) > 16 ? 16 : (height >> j);
 
-	// outLPyramid
-	for (int j = 0; j < maxJ - 1; j++) {
-		global_work_size[0] = (width >> j);
-		global_work_size[1] = (height >> j);
-		local_work_size[0] = (width >> j) > 16 ? 16 : (width >> j);
-		local_work_size[1] = (height >> j) > 16 ? 16 : (height >> j);
+	return clEnqueueNDRangeKernel(ctx->queue, ctx->kernels[kernel], 2, NULL,
+		global_work_size, local_work_size, 0, NULL, NULL);
+}
 
-		clSetKernelArg(kernels[GEN_OUTLPYRAMID], 0, sizeof(cl_mem), &outLPyramid[j]);
-		for (int arg = 0; arg < levels; arg++) {
-			clSetKernelArg(kernels[GEN_OUTLPYRAMID], 1 + arg, sizeof(cl_mem), &gPyramid[j][arg]);
-		}
-		for (int arg = 0; arg < levels; arg++) {
-			clSetKernelArg(kernels[GEN_OUTLPYRAMID], 1 + levels + arg, sizeof(cl_mem), &gPyramid[j+1][arg]);
-		}
-		clSetKernelArg(kernels[GEN_OUTLPYRAMID], 1 + 2 * levels, sizeof(cl_mem), &inGPyramid[j]);
-		err = clEnqueueNDRangeKernel(queue, kernels[GEN_OUTLPYRAMID], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-		if (err != CL_SUCCESS) {
-			printf("Error: %d\n", err);
-			return -1;
-		}
-	}
-	global_work_size[0] = (width >> (maxJ - 1));
-	global_work_size[1] = (height >> (maxJ - 1));
-	local_work_size[0] = (width >> (maxJ - 1)) > 16 ? 16 : (width >> (maxJ - 1));
-	local_work_size[1] = (height >> (maxJ - 1)) > 16 ? 16 : (height >> (maxJ - 1));
+// Uploads src, converts it to floating point and gray, runs the engine and
+// reads the 3 output channels back into dst.
+cl_int process(struct host_ctx *ctx, int engine, uint8_t **src, uint8_t **dst)
+{
+	cl_int err;
+	cl_mem src_d[3];
+	cl_mem floating[3];
+	cl_mem dst_d[3];
+	cl_mem gray;
+	int mark = ctx->num_mems;
 
-	clSetKernelArg(kernels[GEN_OUTLPYRAMIDLOWEST], 0, sizeof(cl_mem), &outLPyramid[maxJ - 1]);
-	for (int arg = 0; arg < levels; arg++) {
-		clSetKernelArg(kernels[GEN_OUTLPYRAMIDLOWEST], 1 + arg, sizeof(cl_mem), &gPyramid[maxJ - 1][arg]);
-	}
-	clSetKernelArg(kernels[GEN_OUTLPYRAMIDLOWEST], 1 + levels, sizeof(cl_mem), &inGPyramid[maxJ - 1]);
-	err = clEnqueueNDRangeKernel(queue, kernels[GEN_OUTLPYRAMIDLOWEST], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-	if (err != CL_SUCCESS) {
-		printf("Error: %d\n", err);
-		return -1;
+	// create cl buffers
+	for (int c = 0; c < 3; c++) {
+		CL_CHECK(ctx_create_buffer(ctx, sizeof(uint8_t) * width * height, &src_d[c]));
+		CL_CHECK(ctx_create_buffer(ctx, sizeof(float) * width * height, &floating[c]));
+		CL_CHECK(ctx_create_buffer(ctx, sizeof(uint8_t) * width * height, &dst_d[c]));
 	}
+	CL_CHECK(ctx_create_buffer(ctx, sizeof(float) * width * height, &gray));
 
-	
-	// outGPyramid[maxJ - 1]
-	err = clEnqueueCopyBuffer(queue, outLPyramid[maxJ - 1],
-			outGPyramid[maxJ - 1], 0, 0, 
-			sizeof(float) * (width >> (maxJ - 1)) * (height >> (maxJ - 1)), 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
-	// outGPyramid
-	for (int j = maxJ - 2; j >= 0; j--) {
-		global_work_size[0] = (width >> j);
-		global_work_size[1] = (height >> j);
-		local_work_size[0] = (width >> j) > 16 ? 16 : (width >> j);
-		local_work_size[1] = (height >> j) > 16 ? 16 : (height >> j);
-
-		clSetKernelArg(kernels[GEN_OUTGPYRAMID], 0, sizeof(cl_mem), &outGPyramid[j]);
-		clSetKernelArg(kernels[GEN_OUTGPYRAMID], 1, sizeof(cl_mem), &outGPyramid[j+1]);
-		clSetKernelArg(kernels[GEN_OUTGPYRAMID], 2, sizeof(cl_mem), &outLPyramid[j]);
-		err = clEnqueueNDRangeKernel(queue, kernels[GEN_OUTGPYRAMID], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-		if (err != CL_SUCCESS) {
-			printf("Error: %d\n", err);
-			return -1;
-		}
+	// Floating
+	for (int c = 0; c < 3; c++) {
+		CL_CHECK(clEnqueueWriteBuffer(ctx->queue, src_d[c], CL_TRUE, 0,
+			sizeof(uint8_t) * width * height, src[c], 0, NULL, NULL));
+
+		SET_ARG(GEN_FLOATING, 0, floating[c]);
+		SET_ARG(GEN_FLOATING, 1, src_d[c]);
+		CL_CHECK(enqueue_level(ctx, GEN_FLOATING, 0));
 	}
 
-	// output
-	global_work_size[0] = width;
-	global_work_size[1] = height;
-	local_work_size[0] = 16;
-	local_work_size[1] = 16;
-
-	clSetKernelArg(kernels[GEN_OUTPUT], 0, sizeof(cl_mem), &dst_r_d);
-	clSetKernelArg(kernels[GEN_OUTPUT], 1, sizeof(cl_mem), &outGPyramid[0]);
-	clSetKernelArg(kernels[GEN_OUTPUT], 2, sizeof(cl_mem), &floating_r);
-	clSetKernelArg(kernels[GEN_OUTPUT], 3, sizeof(cl_mem), &gPyramid[0][0]);
-	err = clEnqueueNDRangeKernel(queue, kernels[GEN_OUTPUT], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
-
-	clSetKernelArg(kernels[GEN_OUTPUT], 0, sizeof(cl_mem), &dst_g_d);
-	clSetKernelArg(kernels[GEN_OUTPUT], 1, sizeof(cl_mem), &outGPyramid[0]);
-	clSetKernelArg(kernels[GEN_OUTPUT], 2, sizeof(cl_mem), &floating_g);
-	clSetKernelArg(kernels[GEN_OUTPUT], 3, sizeof(cl_mem), &gPyramid[0][0]);
-	err = clEnqueueNDRangeKernel(queue, kernels[GEN_OUTPUT], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
-
-	clSetKernelArg(kernels[GEN_OUTPUT], 0, sizeof(cl_mem), &dst_b_d);
-	clSetKernelArg(kernels[GEN_OUTPUT], 1, sizeof(cl_mem), &outGPyramid[0]);
-	clSetKernelArg(kernels[GEN_OUTPUT], 2, sizeof(cl_mem), &floating_b);
-	clSetKernelArg(kernels[GEN_OUTPUT], 3, sizeof(cl_mem), &gPyramid[0][0]);
-	err = clEnqueueNDRangeKernel(queue, kernels[GEN_OUTPUT], 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
+	// Gray
+	SET_ARG(GEN_GRAY, 0, gray);
+	SET_ARG(GEN_GRAY, 1, floating[0]);
+	SET_ARG(GEN_GRAY, 2, floating[1]);
+	SET_ARG(GEN_GRAY, 3, floating[2]);
+	CL_CHECK(enqueue_level(ctx, GEN_GRAY, 0));
 
-	// Read buffer
-	err = clEnqueueReadBuffer(queue, dst_r_d, CL_TRUE, 0, 
-		sizeof(uint8_t) * width * height, dst_r, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
+	CL_CHECK(engines[engine](ctx, gray, floating, dst_d));
 
-	err = clEnqueueReadBuffer(queue, dst_g_d, CL_TRUE, 0, 
-		sizeof(uint8_t) * width * height, dst_g, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
+	// Read buffer
+	for (int c = 0; c < 3; c++) {
+		CL_CHECK(clEnqueueReadBuffer(ctx->queue, dst_d[c], CL_TRUE, 0, 
+			sizeof(uint8_t) * width * height, dst[c], 0, NULL, NULL));
+	}
 
-	err = clEnqueueReadBuffer(queue, dst_b_d, CL_TRUE, 0, 
-		sizeof(uint8_t) * width * height, dst_b, 0, NULL, NULL);
-	assert(err == CL_SUCCESS);
-	
-	gettimeofday(&tim, NULL);  
-    double dTime2 = tim.tv_sec+(tim.tv_usec/1000000.0); 
+cleanup:
+	ctx_release_buffers(ctx, mark);
+	return err;
+}
 
-	returnRGB(dst_r, dst_g, dst_b);
+// This function runs genOutput for the 3 channels. tone is the processed
+// gray image, gray the one the color ratio is taken against.
+cl_int gen_output(struct host_ctx *ctx, cl_mem *dst, cl_mem tone,
+	cl_mem *floating, cl_mem gray)
+{
+	cl_int err;
 
-	write_png_file(argv[2]);
+	for (int c = 0; c < 3; c++) {
+		SET_ARG(GEN_OUTPUT, 0, dst[c]);
+		SET_ARG(GEN_OUTPUT, 1, tone);
+		SET_ARG(GEN_OUTPUT, 2, floating[c]);
+		SET_ARG(GEN_OUTPUT, 3, gray);
+		CL_CHECK(enqueue_level(ctx, GEN_OUTPUT, 0));
+	}
 
-	printf("Elapsed Time: %lf sec\n", dTime2 - dTime1);
+cleanup:
+	return err;
+}
 
-	free(dst_b);
-	free(dst_g);
-	free(dst_r);
+// gPyramid stack of level k, from gray
+static cl_int gen_gpyramid(struct host_ctx *ctx, cl_mem *gPyramid, int k, cl_mem gray)
+{
+	cl_int err;
 
-	free(src_b);
-	free(src_g);
-	free(src_r);
+	SET_ARG(GEN_GPYRAMID0, 0, gPyramid[0]);
+	SET_ARG(GEN_GPYRAMID0, 1, k);
+	SET_ARG(GEN_GPYRAMID0, 2, gray);
+	CL_CHECK(enqueue_level(ctx, GEN_GPYRAMID0, 0));
 
-	// release cl buffers
-	clReleaseMemObject(dst_b_d);
-	clReleaseMemObject(dst_g_d);
-	clReleaseMemObject(dst_r_d);
-	for (int j = 0; j < maxJ; j++) {
-		clReleaseMemObject(outGPyramid[j]);
-	}
-	for (int j = 0; j < maxJ; j++) {
-		clReleaseMemObject(outLPyramid[j]);
-	}
-	for (int j = 0; j < maxJ; j++) {
-		clReleaseMemObject(inGPyramid[j]);
-	}	
-	for (int j = 0; j < maxJ; j++) {
-		for (int k = 0; k < levels; k++) {
-			clReleaseMemObject(gPyramid[j][k]);
-		}
+	for (int j = 1; j < maxJ; j++) {
+		SET_ARG(DOWNSAMPLE_KERNEL, 0, gPyramid[j]);
+		SET_ARG(DOWNSAMPLE_KERNEL, 1, gPyramid[j-1]);
+		CL_CHECK(enqueue_level(ctx, DOWNSAMPLE_KERNEL, j));
 	}
-	clReleaseMemObject(gray);
-	clReleaseMemObject(floating_b);
-	clReleaseMemObject(floating_g);
-	clReleaseMemObject(floating_r);
-	clReleaseMemObject(src_b_d);
-	clReleaseMemObject(src_g_d);
-	clReleaseMemObject(src_r_d);
-	clReleaseKernels(kernels);
-	clReleaseProgram(program);
-	clReleaseCommandQueue(queue);
-	clReleaseContext(context);
-
-    return 0;
+
+cleanup:
+	return err;
 }
 
-void read_png_file(char* file_name)
+// inGPyramid[1..], inGPyramid[0] is gray itself
+static cl_int gen_ingpyramid(struct host_ctx *ctx, cl_mem *inGPyramid)
 {
-	unsigned char header[8];    // 8 is the maximum size that can be checked
-
-	/* open file and test for it being a png */
-	FILE *fp = fopen(file_name, "rb");
-	if (!fp)
-		abort_("[read_png_file] File %s could not be opened for reading", file_name);
-	fread(header, 1, 8, fp);
-	if (png_sig_cmp(header, 0, 8))
-		abort_("[read_png_file] File %s is not recognized as a PNG file", file_name);
+	cl_int err = CL_SUCCESS;
 
+	for (int j = 1; j < maxJ; j++) {
+		SET_ARG(DOWNSAMPLE_KERNEL, 0, inGPyramid[j]);
+		SET_ARG(DOWNSAMPLE_KERNEL, 1, inGPyramid[j-1]);
+		CL_CHECK(enqueue_level(ctx, DOWNSAMPLE_KERNEL, j));
+	}
 
-    /* initialize stuff */
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+cleanup:
+	return err;
+}
 
-    if (!png_ptr)
-            abort_("[read_png_file] png_create_read_struct failed");
+// Collapses outLPyramid into outGPyramid, the result is outGPyramid[0].
+static cl_int gen_outgpyramid(struct host_ctx *ctx, cl_mem *outGPyramid, cl_mem *outLPyramid)
+{
+	cl_int err;
 
-    info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr)
-            abort_("[read_png_file] png_create_info_struct failed");
+	// outGPyramid[maxJ - 1]
+	CL_CHECK(clEnqueueCopyBuffer(ctx->queue, outLPyramid[maxJ - 1],
+			outGPyramid[maxJ - 1], 0, 0, level_size(maxJ - 1), 0, NULL, NULL));
+	// outGPyramid
+	for (int j = maxJ - 2; j >= 0; j--) {
+		SET_ARG(GEN_OUTGPYRAMID, 0, outGPyramid[j]);
+		SET_ARG(GEN_OUTGPYRAMID, 1, outGPyramid[j+1]);
+		SET_ARG(GEN_OUTGPYRAMID, 2, outLPyramid[j]);
+		CL_CHECK(enqueue_level(ctx, GEN_OUTGPYRAMID, j));
+	}
 
-    if (setjmp(png_jmpbuf(png_ptr)))
-            abort_("[read_png_file] Error during init_io");
+cleanup:
+	return err;
+}
 
-    png_init_io(png_ptr, fp);
-    png_set_sig_bytes(png_ptr, 8);
+// Keeps the gPyramid stacks of all levels on the device at once.
+static cl_int laplacian_full(struct host_ctx *ctx, cl_mem gray, cl_mem *floating, cl_mem *dst)
+{
+	cl_int err;
+	cl_mem gPyramid[levels][maxJ];
+	cl_mem inGPyramid[maxJ];
+	cl_mem outLPyramid[maxJ];
+	cl_mem outGPyramid[maxJ];
+	int mark = ctx->num_mems;
 
-    png_read_info(png_ptr, info_ptr);
+	// create cl buffers
+	for (int k = 0; k < levels; k++) {
+		for (int j = 0; j < maxJ; j++)
+			CL_CHECK(ctx_create_buffer(ctx, level_size(j), &gPyramid[k][j]));
+	}
+	inGPyramid[0] = gray;
+	for (int j = 1; j < maxJ; j++)
+		CL_CHECK(ctx_create_buffer(ctx, level_size(j), &inGPyramid[j]));
+	for (int j = 0; j < maxJ; j++) {
+		CL_CHECK(ctx_create_buffer(ctx, level_size(j), &outLPyramid[j]));
+		CL_CHECK(ctx_create_buffer(ctx, level_size(j), &outGPyramid[j]));
+	}
 
-    width = png_get_image_width(png_ptr, info_ptr);
-    height = png_get_image_height(png_ptr, info_ptr);
-    color_type = png_get_color_type(png_ptr, info_ptr);
-    bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+	// gPyramid
+	for (int k = 0; k < levels; k++)
+		CL_CHECK(gen_gpyramid(ctx, gPyramid[k], k, gray));
 
-    number_of_passes = png_set_interlace_handling(png_ptr);
-    png_read_update_info(png_ptr, info_ptr);
+	// inGPyramid
+	CL_CHECK(gen_ingpyramid(ctx, inGPyramid));
 
+	// outLPyramid
+	for (int j = 0; j < maxJ - 1; j++) {
+		SET_ARG(GEN_OUTLPYRAMID, 0, outLPyramid[j]);
+		for (int arg = 0; arg < levels; arg++) {
+			SET_ARG(GEN_OUTLPYRAMID, 1 + arg, gPyramid[arg][j]);
+		}
+		for (int arg = 0; arg < levels; arg++) {
+			SET_ARG(GEN_OUTLPYRAMID, 1 + levels + arg, gPyramid[arg][j+1]);
+		}
+		SET_ARG(GEN_OUTLPYRAMID, 1 + 2 * levels, inGPyramid[j]);
+		CL_CHECK(enqueue_level(ctx, GEN_OUTLPYRAMID, j));
+	}
+	SET_ARG(GEN_OUTLPYRAMIDLOWEST, 0, outLPyramid[maxJ - 1]);
+	for (int arg = 0; arg < levels; arg++) {
+		SET_ARG(GEN_OUTLPYRAMIDLOWEST, 1 + arg, gPyramid[arg][maxJ - 1]);
+	}
+	SET_ARG(GEN_OUTLPYRAMIDLOWEST, 1 + levels, inGPyramid[maxJ - 1]);
+	CL_CHECK(enqueue_level(ctx, GEN_OUTLPYRAMIDLOWEST, maxJ - 1));
 
-    /* read file */
-    if (setjmp(png_jmpbuf(png_ptr)))
-            abort_("[read_png_file] Error during read_image");
+	CL_CHECK(gen_outgpyramid(ctx, outGPyramid, outLPyramid));
 
-    row_pointers = (png_bytep*) malloc(sizeof(png_bytep) * height);
-    for (y=0; y<height; y++)
-            row_pointers[y] = (png_byte*) malloc(png_get_rowbytes(png_ptr,info_ptr));
+	// output
+	CL_CHECK(gen_output(ctx, dst, outGPyramid[0], floating, gPyramid[0][0]));
 
-    png_read_image(png_ptr, row_pointers);
+	// buffers may only be allocated when first used, wait so an allocation
+	// failure shows up here and the caller can still fall back
+	CL_CHECK(clFinish(ctx->queue));
 
-    fclose(fp);
+cleanup:
+	ctx_release_buffers(ctx, mark);
+	return err;
 }
 
-
-void write_png_file(char* file_name)
+// Builds one gPyramid stack at a time and accumulates its share of
+// outLPyramid, so it needs about a third of the device memory.
+static cl_int laplacian_low_memory(struct host_ctx *ctx, cl_mem gray, cl_mem *floating, cl_mem *dst)
 {
-    /* create file */
-    FILE *fp = fopen(file_name, "wb");
-    if (!fp)
-            abort_("[write_png_file] File %s could not be opened for writing", file_name);
-
-
-    /* initialize stuff */
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-
-    if (!png_ptr)
-            abort_("[write_png_file] png_create_write_struct failed");
+	cl_int err;
+	cl_mem gPyramid[maxJ];
+	cl_mem inGPyramid[maxJ];
+	cl_mem outLPyramid[maxJ];
+	cl_mem outGPyramid[maxJ];
+	cl_mem ratioGray;
+	int mark = ctx->num_mems;
 
-    info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr)
-            abort_("[write_png_file] png_create_info_struct failed");
+	// create cl buffers
+	inGPyramid[0] = gray;
+	for (int j = 0; j < maxJ; j++) {
+		CL_CHECK(ctx_create_buffer(ctx, level_size(j), &gPyramid[j]));
+		if (j > 0)
+			CL_CHECK(ctx_create_buffer(ctx, level_size(j), &inGPyramid[j]));
+		CL_CHECK(ctx_create_buffer(ctx, level_size(j), &outLPyramid[j]));
+		CL_CHECK(ctx_create_buffer(ctx, level_size(j), &outGPyramid[j]));
+	}
+	// genOutput divides by gPyramid[0][0], keep a copy of it
+	CL_CHECK(ctx_create_buffer(ctx, level_size(0), &ratioGray));
 
-    if (setjmp(png_jmpbuf(png_ptr)))
-            abort_("[write_png_file] Error during init_io");
+	// inGPyramid
+	CL_CHECK(gen_ingpyramid(ctx, inGPyramid));
 
-    png_init_io(png_ptr, fp);
+	// gPyramid and outLPyramid, one level at a time
+	for (int k = 0; k < levels; k++) {
+		CL_CHECK(gen_gpyramid(ctx, gPyramid, k, gray));
+		if (k == 0) {
+			CL_CHECK(clEnqueueCopyBuffer(ctx->queue, gPyramid[0], ratioGray,
+				0, 0, level_size(0), 0, NULL, NULL));
+		}
 
+		for (int j = 0; j < maxJ; j++) {
+			int lowest = j == maxJ - 1;
+			cl_mem gPyramidLow = lowest ? gPyramid[j] : gPyramid[j+1];
+
+			SET_ARG(ACCUM_OUTLPYRAMID, 0, outLPyramid[j]);
+			SET_ARG(ACCUM_OUTLPYRAMID, 1, gPyramid[j]);
+			SET_ARG(ACCUM_OUTLPYRAMID, 2, gPyramidLow);
+			SET_ARG(ACCUM_OUTLPYRAMID, 3, inGPyramid[j]);
+			SET_ARG(ACCUM_OUTLPYRAMID, 4, k);
+			SET_ARG(ACCUM_OUTLPYRAMID, 5, lowest);
+			CL_CHECK(enqueue_level(ctx, ACCUM_OUTLPYRAMID, j));
+		}
+	}
 
-    /* write header */
-    if (setjmp(png_jmpbuf(png_ptr)))
-            abort_("[write_png_file] Error during writing header");
+	CL_CHECK(gen_outgpyramid(ctx, outGPyramid, outLPyramid));
 
-    png_set_IHDR(png_ptr, info_ptr, width, height,
-                 bit_depth, color_type, PNG_INTERLACE_NONE,
-                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	// output
+	CL_CHECK(gen_output(ctx, dst, outGPyramid[0], floating, ratioGray));
 
-    png_write_info(png_ptr, info_ptr);
+cleanup:
+	ctx_release_buffers(ctx, mark);
+	return err;
+}
 
+// Falls back to the low-memory path, for this and all later images, when the
+// device runs out of memory.
+cl_int laplacian_engine(struct host_ctx *ctx, cl_mem gray, cl_mem *floating, cl_mem *dst)
+{
+	cl_int err;
 
-    /* write bytes */
-    if (setjmp(png_jmpbuf(png_ptr)))
-            abort_("[write_png_file] Error during writing bytes");
+	if (!ctx->low_memory) {
+		err = laplacian_full(ctx, gray, floating, dst);
+		if (!IS_ALLOC_FAILURE(err))
+			return err;
 
-    png_write_image(png_ptr, row_pointers);
+		fprintf(stderr, "Out of device memory (%d), switching to low-memory mode\n", err);
+		ctx->low_memory = 1;
+		// released buffers are only freed once the queued work is done
+		err = clFinish(ctx->queue);
+		if (err != CL_SUCCESS) {
+			fprintf(stderr, "clFinish failed: %d\n", err);
+			return err;
+		}
+	}
 
+	return laplacian_low_memory(ctx, gray, floating, dst);
+}
 
-    /* end write */
-    if (setjmp(png_jmpbuf(png_ptr)))
-            abort_("[write_png_file] Error during end of write");
+cl_int grid_engine(struct host_ctx *ctx, cl_mem gray, cl_mem *floating, cl_mem *dst)
+{
+	cl_int err;
+	int gw = (width - 1 + gridS / 2) / gridS + 1;
+	int gh = (height - 1 + gridS / 2) / gridS + 1;
+	size_t grid_work_size[3] = {gw, gh, gridZ};
+	cl_mem grid, gridTmp, tone;
+	int mark = ctx->num_mems;
+
+	// each grid cell is a (sum, weight) float2
+	CL_CHECK(ctx_create_buffer(ctx, 2 * sizeof(float) * gw * gh * gridZ, &grid));
+	CL_CHECK(ctx_create_buffer(ctx, 2 * sizeof(float) * gw * gh * gridZ, &gridTmp));
+	CL_CHECK(ctx_create_buffer(ctx, sizeof(float) * width * height, &tone));
+
+	// grid
+	SET_ARG(GRID_CONSTRUCT, 0, grid);
+	SET_ARG(GRID_CONSTRUCT, 1, gray);
+	SET_ARG(GRID_CONSTRUCT, 2, width);
+	SET_ARG(GRID_CONSTRUCT, 3, height);
+	CL_CHECK(clEnqueueNDRangeKernel(ctx->queue, ctx->kernels[GRID_CONSTRUCT], 2, NULL,
+		grid_work_size, NULL, 0, NULL, NULL));
+
+	// blur x, y, z ping-ponging between grid and gridTmp, ends in gridTmp
+	for (int axis = 0; axis < 3; axis++) {
+		cl_mem from = axis % 2 ? gridTmp : grid;
+		cl_mem to = axis % 2 ? grid : gridTmp;
+
+		SET_ARG(GRID_BLUR, 0, to);
+		SET_ARG(GRID_BLUR, 1, from);
+		SET_ARG(GRID_BLUR, 2, axis);
+		CL_CHECK(clEnqueueNDRangeKernel(ctx->queue, ctx->kernels[GRID_BLUR], 3, NULL,
+			grid_work_size, NULL, 0, NULL, NULL));
+	}
 
-    png_write_end(png_ptr, NULL);
+	// slice
+	SET_ARG(GRID_SLICE, 0, tone);
+	SET_ARG(GRID_SLICE, 1, gridTmp);
+	SET_ARG(GRID_SLICE, 2, gray);
+	SET_ARG(GRID_SLICE, 3, gw);
+	SET_ARG(GRID_SLICE, 4, gh);
+	CL_CHECK(enqueue_level(ctx, GRID_SLICE, 0));
 
-    /* cleanup heap allocation */
-    for (y=0; y<height; y++)
-            free(row_pointers[y]);
-    free(row_pointers);
+	// output
+	CL_CHECK(gen_output(ctx, dst, tone, floating, gray));
 
-    fclose(fp);
+cleanup:
+	ctx_release_buffers(ctx, mark);
+	return err;
 }
 
-
 void process_file(void)
 {
     if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_RGB)
@@ -617,9 +537,9 @@ void process_file(void)
 		abort_("[process_file] color_type of input file must be PNG_COLOR_TYPE_RGBA (%d) (is %d)",
 				PNG_COLOR_TYPE_RGBA, png_get_color_type(png_ptr, info_ptr));
 
-        for (y=0; y<height; y++) {
+        for (int y=0; y<height; y++) {
                 png_byte* row = row_pointers[y];
-                for (x=0; x<width; x++) {
+                for (int x=0; x<width; x++) {
                         png_byte* ptr = &(row[x*4]);
                         //printf("Pixel at position [ %d - %d ] has RGBA values: %d - %d - %d - %d\n",
                         //       x, y, ptr[0], ptr[1], ptr[2], ptr[3]);
@@ -630,95 +550,3 @@ void process_file(void)
                 }
         }
 }
-
-cl_program load_program(cl_context context, cl_device_id device, const char* filename)
-{
-	FILE *fp;
-	size_t length;
-	char *data;
-	const char* source;
-	size_t ret;
-
-	// open file
-	fp = fopen(filename, "rb");
-	if(fp == NULL)
-		perror("Error opening file\n");
-
-	// get file length
-	fseek (fp, 0, SEEK_END);
-	length = ftell (fp);
-	fseek (fp, 0, SEEK_SET);    // rewind(fp);
-
-	// read program source
-	data = (char*)malloc((length+1) * sizeof(char));
-	ret = fread(data, sizeof(char), length, fp);
-	if(ret != length)
-		perror("Error reading file\n");
-	data[length] = 0;
-
-	// create and build program object
-	source = &data[0];
-	cl_program program = clCreateProgramWithSource(context, 1, &source, NULL, NULL);
-	if(program == 0) {
-		perror("Error creating program\n");
-		return 0;
-	}
-
-	// compile program
-	if(clBuildProgram(program, 0, NULL, NULL, NULL, NULL) != CL_SUCCESS)
-	{
-		cl_int err;
-		size_t len;
-		char *buffer;
-
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
-		buffer = calloc(sizeof(char), len);
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, len, buffer, NULL);
-		printf( "Error building program %d: %s\n", err, buffer);
-		return 0;
-	}
-
-	free(data);
-	fclose(fp);
-
-	return program;
-}
-
-int clCreateKernels(cl_program program, cl_kernel **kernels_ptr)
-{
-	cl_int err;
-	cl_kernel *kernels = (cl_kernel *)malloc(NUM_KERNELS * sizeof(cl_kernel));
-	char kernels_name[NUM_KERNELS][35] = {
-		"genFloating",
-		"genGray",
-		"genGPyramid0",
-		"downSampleKernel",
-		"genOutLPyramidLowest",
-		"genOutLPyramid",
-		"genOutGPyramid",
-		"genOutput",
-	};
-	for (int i = 0; i < NUM_KERNELS; i++)
-	{
-		kernels[i] = clCreateKernel(program, kernels_name[i], &err);
-		if (err != CL_SUCCESS)
-		{
-			printf("Create kernels error %d\n", err);
-			return err;
-		}
-	}
-
-	*kernels_ptr = kernels;
-
-	return CL_SUCCESS;
-}
-
-int clReleaseKernels(cl_kernel *kernels)
-{
-	for (int i = 0; i < NUM_KERNELS; i++)
-	{
-		clReleaseKernel(kernels[i]);
-	}
-
-	return CL_SUCCESS;
-}
@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "png_io.h"
+
+void abort_(const char * s, ...)
+{
+	va_list args;
+	va_start(args, s);
+	vfprintf(stderr, s, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	abort();
+}
+
+int width, height;
+png_byte color_type;
+png_byte bit_depth;
+
+png_structp png_ptr;
+png_infop info_ptr;
+int number_of_passes;
+png_bytep * row_pointers;
+
+// Releases whatever read_png_file got to before failing. png_ptr and
+// info_ptr may still be NULL.
+static int read_failed(FILE *fp, const char *msg, const char *file_name)
+{
+	fprintf(stderr, "[read_png_file] %s %s\n", msg, file_name);
+	if (row_pointers)
+		free_png_rows(row_pointers, height);
+	row_pointers = NULL;
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	fclose(fp);
+	return -1;
+}
+
+int read_png_file(char* file_name)
+{
+	unsigned char header[8];    // 8 is the maximum size that can be checked
+
+	png_ptr = NULL;
+	info_ptr = NULL;
+	row_pointers = NULL;
+
+	/* open file and test for it being a png */
+	FILE *fp = fopen(file_name, "rb");
+	if (!fp) {
+		fprintf(stderr, "[read_png_file] File %s could not be opened for reading\n", file_name);
+		return -1;
+	}
+	if (fread(header, 1, 8, fp) != 8 || png_sig_cmp(header, 0, 8))
+		return read_failed(fp, "Not recognized as a PNG file:", file_name);
+
+
+    /* initialize stuff */
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+
+    if (!png_ptr)
+            return read_failed(fp, "png_create_read_struct failed for", file_name);
+
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr)
+            return read_failed(fp, "png_create_info_struct failed for", file_name);
+
+    // libpng longjmps here on any error below, including corrupt data
+    if (setjmp(png_jmpbuf(png_ptr)))
+            return read_failed(fp, "Error while decoding", file_name);
+
+    png_init_io(png_ptr, fp);
+    png_set_sig_bytes(png_ptr, 8);
+
+    png_read_info(png_ptr, info_ptr);
+
+    width = png_get_image_width(png_ptr, info_ptr);
+    height = png_get_image_height(png_ptr, info_ptr);
+    color_type = png_get_color_type(png_ptr, info_ptr);
+    bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+
+    // the host routines work on 8-bit RGBA rows only
+    if (bit_depth == 16)
+            png_set_strip_16(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+            png_set_palette_to_rgb(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+            png_set_expand_gray_1_2_4_to_8(png_ptr);
+    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+            png_set_tRNS_to_alpha(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+            png_set_gray_to_rgb(png_ptr);
+    if (!(color_type & PNG_COLOR_MASK_ALPHA) && !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+            png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
+
+    number_of_passes = png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+
+    color_type = PNG_COLOR_TYPE_RGBA;
+    bit_depth = 8;
+
+
+    /* read file */
+    // calloc so a partial allocation can be freed row by row
+    row_pointers = (png_bytep*) calloc(height, sizeof(png_bytep));
+    if (!row_pointers)
+            return read_failed(fp, "Out of memory reading", file_name);
+    for (int y=0; y<height; y++) {
+            row_pointers[y] = (png_byte*) malloc(png_get_rowbytes(png_ptr,info_ptr));
+            if (!row_pointers[y])
+                    return read_failed(fp, "Out of memory reading", file_name);
+    }
+
+    png_read_image(png_ptr, row_pointers);
+
+    fclose(fp);
+    return 0;
+}
+
+
+// Drops the write struct, the rows and the partial output file.
+static int write_failed(FILE *fp, const char *msg, const char *file_name)
+{
+	fprintf(stderr, "[write_png_file] %s %s\n", msg, file_name);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	if (row_pointers)
+		free_png_rows(row_pointers, height);
+	row_pointers = NULL;
+	fclose(fp);
+	remove(file_name);
+	return -1;
+}
+
+int write_png_file(char* file_name)
+{
+    png_ptr = NULL;
+    info_ptr = NULL;
+
+    /* create file */
+    FILE *fp = fopen(file_name, "wb");
+    if (!fp) {
+            fprintf(stderr, "[write_png_file] File %s could not be opened for writing\n", file_name);
+            if (row_pointers)
+                    free_png_rows(row_pointers, height);
+            row_pointers = NULL;
+            return -1;
+    }
+
+
+    /* initialize stuff */
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+
+    if (!png_ptr)
+            return write_failed(fp, "png_create_write_struct failed for", file_name);
+
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr)
+            return write_failed(fp, "png_create_info_struct failed for", file_name);
+
+    // libpng longjmps here on any error below
+    if (setjmp(png_jmpbuf(png_ptr)))
+            return write_failed(fp, "Error while writing", file_name);
+
+    png_init_io(png_ptr, fp);
+
+
+    /* write header */
+    png_set_IHDR(png_ptr, info_ptr, width, height,
+                 bit_depth, color_type, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+    png_write_info(png_ptr, info_ptr);
+
+
+    /* write bytes */
+    png_write_image(png_ptr, row_pointers);
+
+
+    /* end write */
+    png_write_end(png_ptr, NULL);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+
+    /* cleanup heap allocation */
+    free_png_rows(row_pointers, height);
+    row_pointers = NULL;
+
+    if (fclose(fp) != 0) {
+            fprintf(stderr, "[write_png_file] Error closing %s\n", file_name);
+            remove(file_name);
+            return -1;
+    }
+    return 0;
+}
+
+
+void free_png_rows(png_bytep *rows, int rows_height)
+{
+	for (int y = 0; y < rows_height; y++)
+		free(rows[y]);
+	free(rows);
+}
@@ -0,0 +1,27 @@
+#ifndef PNG_IO_H
+#define PNG_IO_H
+
+#define PNG_DEBUG 3
+#include <png.h>
+
+extern int width, height;
+extern png_byte color_type;
+extern png_byte bit_depth;
+
+extern png_structp png_ptr;
+extern png_infop info_ptr;
+extern int number_of_passes;
+extern png_bytep * row_pointers;
+
+void abort_(const char * s, ...);
+
+// Both operate on the globals above and return 0, or -1 after printing
+// the error and releasing the file, the libpng structs and the rows.
+// On success the caller still owns the read struct (png_destroy_read_struct);
+// write_png_file always frees row_pointers, free_png_rows releases them
+// without writing.
+int read_png_file(char* file_name);
+int write_png_file(char* file_name);
+void free_png_rows(png_bytep *rows, int rows_height);
+
+#endif
@@ -0,0 +1,417 @@
+// CPU reference implementation of the local_laplacian.cl and
+// bilateral_grid.cl pipelines, used by `make check` to validate the OpenCL
+// output. Each helper mirrors the kernel of the same name, including the way
+// it derives the source image size.
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "png_io.h"
+#include "image_ops.h"
+
+#define maxJ 8
+#define levels 8
+#define alpha (1.0f / (levels - 1))
+
+#define gridS 16
+#define gridZ 16
+#define detail 2.0f
+
+static int clampi(int v, int lo, int hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static float downSample(int x, int y, int w, int h, const float *src)
+{
+	static const float weights[4] = { 1, 3, 3, 1 };
+	float sum = 0.0f;
+
+	for (int dy = 0; dy < 4; dy++) {
+		int sy = clampi(2 * y - 1 + dy, 0, h - 1);
+		for (int dx = 0; dx < 4; dx++) {
+			int sx = clampi(2 * x - 1 + dx, 0, w - 1);
+			sum += weights[dy] * weights[dx] * src[sy * w + sx];
+		}
+	}
+
+	return sum / 64.0f;
+}
+
+static float upSample(int x, int y, int w, int h, const float *src)
+{
+	float sum = 0.0f;
+
+	sum += 1 * src[clampi(y/2 - 1 + 2*(y%2), 0, h - 1) * w +
+		clampi(x/2 - 1 + 2*(x%2), 0, w - 1)];
+	sum += 3 * src[clampi(y/2 - 1 + 2*(y%2), 0, h - 1) * w +
+		clampi(x/2, 0, w - 1)];
+	sum += 3 * src[clampi(y/2, 0, h - 1) * w +
+		clampi(x/2 - 1 + 2*(x%2), 0, w - 1)];
+	sum += 9 * src[clampi(y/2, 0, h - 1) * w +
+		clampi(x/2, 0, w - 1)];
+
+	return sum / 16.0f;
+}
+
+static void genGPyramid0(float *dest, int k, const float *gray, int w, int h)
+{
+	for (int i = 0; i < w * h; i++) {
+		float idx = gray[i] * (float)(levels - 1) * 256.0f;
+		int idxi = clampi((int)idx, 0, (levels - 1) * 256);
+		float fx = (idxi - 256 * k) / 256.0f;
+		dest[i] = gray[i] + alpha * fx * expf(-fx*fx/2.0f);
+	}
+}
+
+static void downSampleKernel(float *dest, const float *src, int w, int h)
+{
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+			dest[y * w + x] = downSample(x, y, w * 2, h * 2, src);
+}
+
+static void genOutLPyramid(float *dest, float **gPyramid, float **gPyramidLow,
+	const float *inGPyramid, int w, int h)
+{
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			float level = inGPyramid[y * w + x] * (levels - 1);
+			int li = clampi((int)level, 0, levels - 2);
+			float lf = level - (float)li;
+			float lPyramid1 = gPyramid[li][y * w + x];
+			float lPyramid2 = gPyramid[li+1][y * w + x];
+			if (gPyramidLow) {
+				lPyramid1 -= upSample(x, y, w / 2, h / 2, gPyramidLow[li]);
+				lPyramid2 -= upSample(x, y, w / 2, h / 2, gPyramidLow[li+1]);
+			}
+			dest[y * w + x] = (1.0f - lf) * lPyramid1 + lf * lPyramid2;
+		}
+	}
+}
+
+// Adds the share of gPyramid level k, call for k = 0 .. levels - 1 in order.
+// gPyramidLow is NULL for the lowest level.
+static void accumOutLPyramid(float *dest, const float *gPyramid,
+	const float *gPyramidLow, const float *inGPyramid, int k, int w, int h)
+{
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			float level = inGPyramid[y * w + x] * (levels - 1);
+			int li = clampi((int)level, 0, levels - 2);
+			float lf = level - (float)li;
+			float sum = k == 0 ? 0.0f : dest[y * w + x];
+			if (k == li || k == li + 1) {
+				float lPyramid = gPyramid[y * w + x];
+				if (gPyramidLow)
+					lPyramid -= upSample(x, y, w / 2, h / 2, gPyramidLow);
+				sum += (k == li ? 1.0f - lf : lf) * lPyramid;
+			}
+			dest[y * w + x] = sum;
+		}
+	}
+}
+
+static void genOutGPyramid(float *dest, const float *outGPyramidLow,
+	const float *outLPyramid, int w, int h)
+{
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+			dest[y * w + x] = upSample(x, y, w / 2, h / 2, outGPyramidLow) +
+				outLPyramid[y * w + x];
+}
+
+static void genOutput(uint8_t *dest, float *color, const float *outGPyramid,
+	const float *floating, const float *gray, int w, int h)
+{
+	const float eps = 0.01f;
+
+	for (int i = 0; i < w * h; i++)
+		color[i] = outGPyramid[i] * (floating[i] + eps) / (gray[i] + eps);
+	float_to_uchar(dest, color, w, h);
+}
+
+static float *alloc_plane(int j)
+{
+	size_t n = (size_t)(width >> j) * (height >> j);
+	float *p = (float *)malloc(sizeof(float) * (n ? n : 1));
+	if (!p)
+		abort_("[reference] out of memory");
+	return p;
+}
+
+// tone gets the processed gray image, ratio_gray the gray image genOutput
+// divides by.
+static void laplacian_engine(float *tone, float *ratio_gray, float *gray)
+{
+	float *gPyramid[maxJ][levels];
+	float *inGPyramid[maxJ], *outLPyramid[maxJ], *outGPyramid[maxJ];
+
+	for (int j = 0; j < maxJ; j++) {
+		for (int k = 0; k < levels; k++)
+			gPyramid[j][k] = alloc_plane(j);
+		inGPyramid[j] = j ? alloc_plane(j) : gray;
+		outLPyramid[j] = alloc_plane(j);
+		outGPyramid[j] = j ? alloc_plane(j) : tone;
+	}
+
+	for (int k = 0; k < levels; k++) {
+		genGPyramid0(gPyramid[0][k], k, gray, width, height);
+		for (int j = 1; j < maxJ; j++)
+			downSampleKernel(gPyramid[j][k], gPyramid[j-1][k], width >> j, height >> j);
+	}
+	for (int j = 1; j < maxJ; j++)
+		downSampleKernel(inGPyramid[j], inGPyramid[j-1], width >> j, height >> j);
+
+	for (int j = 0; j < maxJ - 1; j++)
+		genOutLPyramid(outLPyramid[j], gPyramid[j], gPyramid[j+1], inGPyramid[j],
+			width >> j, height >> j);
+	genOutLPyramid(outLPyramid[maxJ - 1], gPyramid[maxJ - 1], NULL, inGPyramid[maxJ - 1],
+		width >> (maxJ - 1), height >> (maxJ - 1));
+
+	memcpy(outGPyramid[maxJ - 1], outLPyramid[maxJ - 1],
+		sizeof(float) * (width >> (maxJ - 1)) * (height >> (maxJ - 1)));
+	for (int j = maxJ - 2; j >= 0; j--)
+		genOutGPyramid(outGPyramid[j], outGPyramid[j+1], outLPyramid[j],
+			width >> j, height >> j);
+
+	memcpy(ratio_gray, gPyramid[0][0], sizeof(float) * width * height);
+
+	for (int j = 0; j < maxJ; j++) {
+		for (int k = 0; k < levels; k++)
+			free(gPyramid[j][k]);
+		if (j) {
+			free(inGPyramid[j]);
+			free(outGPyramid[j]);
+		}
+		free(outLPyramid[j]);
+	}
+}
+
+// Same result as laplacian_engine, built one gPyramid stack at a time like
+// laplacian_low_memory in main.c.
+static void laplacian_low_memory(float *tone, float *ratio_gray, float *gray)
+{
+	float *gPyramid[maxJ];
+	float *inGPyramid[maxJ], *outLPyramid[maxJ], *outGPyramid[maxJ];
+
+	for (int j = 0; j < maxJ; j++) {
+		gPyramid[j] = alloc_plane(j);
+		inGPyramid[j] = j ? alloc_plane(j) : gray;
+		outLPyramid[j] = alloc_plane(j);
+		outGPyramid[j] = j ? alloc_plane(j) : tone;
+	}
+
+	for (int j = 1; j < maxJ; j++)
+		downSampleKernel(inGPyramid[j], inGPyramid[j-1], width >> j, height >> j);
+
+	for (int k = 0; k < levels; k++) {
+		genGPyramid0(gPyramid[0], k, gray, width, height);
+		for (int j = 1; j < maxJ; j++)
+			downSampleKernel(gPyramid[j], gPyramid[j-1], width >> j, height >> j);
+		if (k == 0)
+			memcpy(ratio_gray, gPyramid[0], sizeof(float) * width * height);
+
+		for (int j = 0; j < maxJ; j++)
+			accumOutLPyramid(outLPyramid[j], gPyramid[j],
+				j == maxJ - 1 ? NULL : gPyramid[j+1], inGPyramid[j], k,
+				width >> j, height >> j);
+	}
+
+	memcpy(outGPyramid[maxJ - 1], outLPyramid[maxJ - 1],
+		sizeof(float) * (width >> (maxJ - 1)) * (height >> (maxJ - 1)));
+	for (int j = maxJ - 2; j >= 0; j--)
+		genOutGPyramid(outGPyramid[j], outGPyramid[j+1], outLPyramid[j],
+			width >> j, height >> j);
+
+	for (int j = 0; j < maxJ; j++) {
+		free(gPyramid[j]);
+		if (j) {
+			free(inGPyramid[j]);
+			free(outGPyramid[j]);
+		}
+		free(outLPyramid[j]);
+	}
+}
+
+// grid cells are (sum, weight) pairs, laid out as in bilateral_grid.cl
+static void gridConstruct(float *grid, const float *gray, int gw, int gh)
+{
+	for (int gy = 0; gy < gh; gy++) {
+		for (int gx = 0; gx < gw; gx++) {
+			int x0 = gx * gridS - gridS / 2 > 0 ? gx * gridS - gridS / 2 : 0;
+			int x1 = gx * gridS + gridS / 2 < width ? gx * gridS + gridS / 2 : width;
+			int y0 = gy * gridS - gridS / 2 > 0 ? gy * gridS - gridS / 2 : 0;
+			int y1 = gy * gridS + gridS / 2 < height ? gy * gridS + gridS / 2 : height;
+			for (int z = 0; z < gridZ; z++) {
+				grid[2 * ((z * gh + gy) * gw + gx)] = 0.0f;
+				grid[2 * ((z * gh + gy) * gw + gx) + 1] = 0.0f;
+			}
+			for (int y = y0; y < y1; y++) {
+				for (int x = x0; x < x1; x++) {
+					float g = gray[y * width + x];
+					int z = clampi((int)(g * (gridZ - 1) + 0.5f), 0, gridZ - 1);
+					grid[2 * ((z * gh + gy) * gw + gx)] += g;
+					grid[2 * ((z * gh + gy) * gw + gx) + 1] += 1.0f;
+				}
+			}
+		}
+	}
+}
+
+static void gridBlur(float *dest, const float *src, int axis, int gw, int gh)
+{
+	static const float weights[5] = { 1.0f, 4.0f, 6.0f, 4.0f, 1.0f };
+	int size = axis == 0 ? gw : (axis == 1 ? gh : gridZ);
+	int stride = axis == 0 ? 1 : (axis == 1 ? gw : gw * gh);
+
+	for (int z = 0; z < gridZ; z++) {
+		for (int y = 0; y < gh; y++) {
+			for (int x = 0; x < gw; x++) {
+				int i = (z * gh + y) * gw + x;
+				int pos = axis == 0 ? x : (axis == 1 ? y : z);
+				float sum = 0.0f, weight = 0.0f;
+				for (int d = -2; d <= 2; d++) {
+					if (pos + d >= 0 && pos + d < size) {
+						sum += weights[d + 2] * src[2 * (i + d * stride)];
+						weight += weights[d + 2] * src[2 * (i + d * stride) + 1];
+					}
+				}
+				dest[2 * i] = sum / 16.0f;
+				dest[2 * i + 1] = weight / 16.0f;
+			}
+		}
+	}
+}
+
+static float mixf(float a, float b, float t)
+{
+	return a + (b - a) * t;
+}
+
+static void gridSlice(float *dest, const float *grid, const float *gray, int gw, int gh)
+{
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float g = gray[y * width + x];
+			float fx = (float)x / gridS;
+			float fy = (float)y / gridS;
+			float fz = (g < 0.0f ? 0.0f : (g > 1.0f ? 1.0f : g)) * (gridZ - 1);
+			int x0 = clampi((int)fx, 0, gw - 1);
+			int y0 = clampi((int)fy, 0, gh - 1);
+			int z0 = clampi((int)fz, 0, gridZ - 1);
+			int x1 = clampi(x0 + 1, 0, gw - 1);
+			int y1 = clampi(y0 + 1, 0, gh - 1);
+			int z1 = clampi(z0 + 1, 0, gridZ - 1);
+			float wx = fx - x0 < 1.0f ? fx - x0 : 1.0f;
+			float wy = fy - y0 < 1.0f ? fy - y0 : 1.0f;
+			float wz = fz - z0 < 1.0f ? fz - z0 : 1.0f;
+			float v[2];
+
+			for (int c = 0; c < 2; c++) {
+				float c00 = mixf(grid[2 * ((z0 * gh + y0) * gw + x0) + c], grid[2 * ((z0 * gh + y0) * gw + x1) + c], wx);
+				float c01 = mixf(grid[2 * ((z0 * gh + y1) * gw + x0) + c], grid[2 * ((z0 * gh + y1) * gw + x1) + c], wx);
+				float c10 = mixf(grid[2 * ((z1 * gh + y0) * gw + x0) + c], grid[2 * ((z1 * gh + y0) * gw + x1) + c], wx);
+				float c11 = mixf(grid[2 * ((z1 * gh + y1) * gw + x0) + c], grid[2 * ((z1 * gh + y1) * gw + x1) + c], wx);
+				v[c] = mixf(mixf(c00, c01, wy), mixf(c10, c11, wy), wz);
+			}
+
+			float base = v[1] > 0.0f ? v[0] / v[1] : g;
+			dest[y * width + x] = base + detail * (g - base);
+		}
+	}
+}
+
+static void grid_engine(float *tone, float *ratio_gray, float *gray)
+{
+	int gw = (width - 1 + gridS / 2) / gridS + 1;
+	int gh = (height - 1 + gridS / 2) / gridS + 1;
+	float *grid = (float *)malloc(2 * sizeof(float) * gw * gh * gridZ);
+	float *gridTmp = (float *)malloc(2 * sizeof(float) * gw * gh * gridZ);
+	if (!grid || !gridTmp)
+		abort_("[reference] out of memory");
+
+	gridConstruct(grid, gray, gw, gh);
+	gridBlur(gridTmp, grid, 0, gw, gh);
+	gridBlur(grid, gridTmp, 1, gw, gh);
+	gridBlur(gridTmp, grid, 2, gw, gh);
+	gridSlice(tone, gridTmp, gray, gw, gh);
+	memcpy(ratio_gray, gray, sizeof(float) * width * height);
+
+	free(gridTmp);
+	free(grid);
+}
+
+int main(int argc, char **argv)
+{
+	void (*engine)(float *, float *, float *) = laplacian_engine;
+
+	int low_memory = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:l")) != -1) {
+		if (opt == 'e' && strcmp(optarg, "grid") == 0)
+			engine = grid_engine;
+		else if (opt == 'e' && strcmp(optarg, "laplacian") == 0)
+			engine = laplacian_engine;
+		else if (opt == 'l')
+			low_memory = 1;
+		else
+			abort_("Usage: reference [-e laplacian|grid] [-l] <file_in> <file_out>");
+	}
+	if (argc - optind != 2)
+		abort_("Usage: reference [-e laplacian|grid] [-l] <file_in> <file_out>");
+	// -l only changes the laplacian engine, as in main
+	if (low_memory && engine == laplacian_engine)
+		engine = laplacian_low_memory;
+
+	if (read_png_file(argv[optind]) != 0)
+		return 1;
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+	size_t n = (size_t)width * height;
+	uint8_t *src[3], *dst[3];
+	float *floating[3];
+	for (int c = 0; c < 3; c++) {
+		src[c] = (uint8_t *)malloc(n);
+		dst[c] = (uint8_t *)malloc(n);
+		floating[c] = alloc_plane(0);
+	}
+	float *gray = alloc_plane(0);
+	float *tone = alloc_plane(0);
+	float *ratio_gray = alloc_plane(0);
+	float *color = alloc_plane(0);
+
+	deinterleave_rgba(row_pointers, width, height, src[0], src[1], src[2]);
+	for (int c = 0; c < 3; c++)
+		uchar_to_float(floating[c], src[c], width, height);
+
+	for (size_t i = 0; i < n; i++)
+		gray[i] = 0.299f * floating[0][i] +
+			0.587f * floating[1][i] +
+			0.114f * floating[2][i];
+
+	engine(tone, ratio_gray, gray);
+
+	for (int c = 0; c < 3; c++)
+		genOutput(dst[c], color, tone, floating[c], ratio_gray, width, height);
+
+	interleave_rgba(row_pointers, width, height, dst[0], dst[1], dst[2]);
+	int ret = write_png_file(argv[optind + 1]) != 0;
+
+	free(color);
+	free(ratio_gray);
+	free(tone);
+	free(gray);
+	for (int c = 0; c < 3; c++) {
+		free(floating[c]);
+		free(dst[c]);
+		free(src[c]);
+	}
+
+	return ret;
+}